@@ -24,6 +24,13 @@ HEADERS  += version.h \
     pagesettingsdialog.h \
     colorbutton.h \
     stroke.h \
+    styletable.h \
+    strokearena.h \
+    numberparser.h \
+    pageloader.h \
+    journal.h \
+    filesync.h \
+    gzipdevice.h \
     mrdoc.h
 
 #VERSION_MAJOR = MY_MAJOR_VERSION
@@ -40,7 +47,17 @@ SOURCES += main.cpp\
     tabletapplication.cpp \
     pagesettingsdialog.cpp \
     colorbutton.cpp \
-    stroke.cpp
+    stroke.cpp \
+    styletable.cpp \
+    strokearena.cpp \
+    numberparser.cpp \
+    pageloader.cpp \
+    journal.cpp \
+    filesync.cpp \
+    gzipdevice.cpp \
+    strokegrid.cpp \
+    eraser.cpp \
+    pagecache.cpp
 
 HEADERS  += mainwindow.h \
     widget.h \
@@ -51,7 +68,10 @@ HEADERS  += mainwindow.h \
     commands.h \
     tictoc.h \
     tabletapplication.h \
-    version.h
+    version.h \
+    strokegrid.h \
+    eraser.h \
+    pagecache.h
 
 FORMS    +=
 
@@ -11,62 +11,72 @@
  * @param newWidget
  * @param newPageNum
  * @param newStroke
- * @param newStrokeNum
  * @param newUpdate
  * @param newUpdateSuccessive
  * @param parent
  * @todo remove parameter newUpdate
  */
-AddStrokeCommand::AddStrokeCommand(Widget *newWidget, int newPageNum, const MrDoc::Stroke &newStroke, int newStrokeNum, bool newUpdate,
-                                   bool newUpdateSuccessive, QUndoCommand *parent)
+AddStrokeCommand::AddStrokeCommand(Widget *newWidget, int newPageNum, const MrDoc::Stroke &newStroke, bool newUpdate, bool newUpdateSuccessive,
+                                   QUndoCommand *parent)
     : QUndoCommand(parent)
 {
   setText(MainWindow::tr("Add Stroke"));
   pageNum = newPageNum;
   widget = newWidget;
   stroke = newStroke;
-  strokeNum = newStrokeNum;
   update = newUpdate;
   updateSuccessive = newUpdateSuccessive;
 
   // delete duplicate points
-  for (int i = stroke.points.length() - 1; i > 0; --i)
+  const float *xs = stroke.xData();
+  const float *ys = stroke.yData();
+  const float *pressures = stroke.pressureData();
+  int n = stroke.size();
+  QVector<float> uniqueXs;
+  QVector<float> uniqueYs;
+  QVector<float> uniquePressures;
+  uniqueXs.reserve(n);
+  uniqueYs.reserve(n);
+  uniquePressures.reserve(n);
+  for (int i = 0; i < n; ++i)
   {
-    if (stroke.points.at(i) == stroke.points.at(i - 1))
+    if (i == 0 || xs[i] != xs[i - 1] || ys[i] != ys[i - 1])
     {
-      stroke.points.removeAt(i);
-      stroke.pressures.removeAt(i);
+      uniqueXs.append(xs[i]);
+      uniqueYs.append(ys[i]);
+      uniquePressures.append(pressures[i]);
     }
   }
+  if (uniqueXs.size() != n)
+  {
+    stroke.setPoints(uniqueXs, uniqueYs, uniquePressures);
+  }
+  // strokes that are being drawn are painted segment by segment
+  stroke.finish();
 }
 
 void AddStrokeCommand::undo()
 {
-  if (stroke.points.length() > 0)
+  if (stroke.size() > 0)
   {
-    if (strokeNum == -1)
-    {
-      widget->currentDocument.pages[pageNum].removeStrokeAt(widget->currentDocument.pages[pageNum].strokes().size() - 1);
-    }
-    else
-    {
-      widget->currentDocument.pages[pageNum].removeStrokeAt(strokeNum);
-    }
+    widget->currentDocument.pages[pageNum].removeStroke(strokeId);
+    widget->journal.strokeRemoved(pageNum, strokeId);
   }
 }
 
 void AddStrokeCommand::redo()
 {
-  if (stroke.points.length() > 0)
+  if (stroke.size() > 0)
   {
-    if (strokeNum == -1)
+    if (strokeId == 0)
     {
-      widget->currentDocument.pages[pageNum].appendStroke(stroke);
+      strokeId = widget->currentDocument.pages[pageNum].appendStroke(stroke);
     }
     else
     {
-      widget->currentDocument.pages[pageNum].insertStroke(strokeNum, stroke);
+      widget->currentDocument.pages[pageNum].restoreStroke(strokeId, stroke);
     }
+    widget->journal.strokeAdded(pageNum, widget->currentDocument.pages[pageNum], strokeId);
   }
 }
 
@@ -88,17 +98,18 @@ RemoveStrokeCommand::RemoveStrokeCommand(Widget *newWidget, int newPageNum, int
   setText(MainWindow::tr("Remove Stroke"));
   pageNum = newPageNum;
   widget = newWidget;
-  strokeNum = newStrokeNum;
-  stroke = widget->currentDocument.pages[pageNum].strokes()[strokeNum];
+  strokeId = widget->currentDocument.pages[pageNum].strokeId(newStrokeNum);
+  stroke = widget->currentDocument.pages[pageNum].strokes()[newStrokeNum];
   update = newUpdate;
 }
 
 void RemoveStrokeCommand::undo()
 {
-  widget->currentDocument.pages[pageNum].insertStroke(strokeNum, stroke);
+  widget->currentDocument.pages[pageNum].restoreStroke(strokeId, stroke);
+  widget->journal.strokeAdded(pageNum, widget->currentDocument.pages[pageNum], strokeId);
 
   qreal zoom = widget->zoom;
-  QRect updateRect = stroke.points.boundingRect().toRect();
+  QRect updateRect = stroke.boundingRectSansPenWidth().toRect();
   updateRect = QRect(zoom * updateRect.topLeft(), zoom * updateRect.bottomRight());
   int delta = zoom * 10;
   updateRect.adjust(-delta, -delta, delta, delta);
@@ -106,15 +117,107 @@ void RemoveStrokeCommand::undo()
 
 void RemoveStrokeCommand::redo()
 {
-  widget->currentDocument.pages[pageNum].removeStrokeAt(strokeNum);
+  widget->currentDocument.pages[pageNum].removeStroke(strokeId);
+  widget->journal.strokeRemoved(pageNum, strokeId);
 
   qreal zoom = widget->zoom;
-  QRect updateRect = stroke.points.boundingRect().toRect();
+  QRect updateRect = stroke.boundingRectSansPenWidth().toRect();
   updateRect = QRect(zoom * updateRect.topLeft(), zoom * updateRect.bottomRight());
   int delta = zoom * 10;
   updateRect.adjust(-delta, -delta, delta, delta);
 }
 
+/******************************************************************************
+** EraseCommand
+*/
+
+/**
+ * @brief EraseCommand::EraseCommand
+ * @param widget
+ * @param pageNum
+ * @param hits as returned by MrDoc::Eraser::erase(), sorted by stroke number
+ * @param parent
+ */
+EraseCommand::EraseCommand(Widget *widget, int pageNum, const QVector<MrDoc::Eraser::Hit> &hits, QUndoCommand *parent) : QUndoCommand(parent)
+{
+  setText(MainWindow::tr("Erase"));
+  m_widget = widget;
+
+  const MrDoc::Page &page = m_widget->currentDocument.pages[pageNum];
+  m_deltas.reserve(hits.size());
+  for (const MrDoc::Eraser::Hit &hit : hits)
+  {
+    m_deltas.append({pageNum, page.strokeId(hit.strokeNum), page.strokes().at(hit.strokeNum), m_pieces.size(), hit.pieces.size()});
+    m_pieces += hit.pieces;
+  }
+}
+
+void EraseCommand::undo()
+{
+  for (int i = m_deltas.size() - 1; i >= 0; --i)
+  {
+    const Delta &delta = m_deltas.at(i);
+    MrDoc::Page &page = m_widget->currentDocument.pages[delta.pageNum];
+    for (int k = 0; k < delta.numPieces; ++k)
+    {
+      page.removeStroke(m_pieceIds.at(delta.firstPiece + k));
+    }
+    page.restoreStroke(delta.strokeId, delta.stroke);
+    m_widget->journal.strokesRemoved(delta.pageNum, m_pieceIds.mid(delta.firstPiece, delta.numPieces));
+    m_widget->journal.strokeAdded(delta.pageNum, page, delta.strokeId);
+  }
+}
+
+/**
+ * @brief EraseCommand::redo replaces the erased strokes by their pieces. The first time, the pieces are inserted behind the tombstone of their
+ * stroke; afterwards, removing and restoring by id only touches the strokes of the command.
+ */
+void EraseCommand::redo()
+{
+  bool firstRedo = m_pieceIds.isEmpty();
+  for (const Delta &delta : m_deltas)
+  {
+    MrDoc::Page &page = m_widget->currentDocument.pages[delta.pageNum];
+    page.removeStroke(delta.strokeId);
+    MrDoc::StrokeId previousId = delta.strokeId;
+    for (int k = 0; k < delta.numPieces; ++k)
+    {
+      const MrDoc::Stroke &piece = m_pieces.at(delta.firstPiece + k);
+      if (firstRedo)
+      {
+        previousId = page.insertStrokeAfter(previousId, piece);
+        m_pieceIds.append(previousId);
+      }
+      else
+      {
+        page.restoreStroke(m_pieceIds.at(delta.firstPiece + k), piece);
+      }
+    }
+    m_widget->journal.strokeRemoved(delta.pageNum, delta.strokeId);
+    m_widget->journal.strokesAdded(delta.pageNum, page, m_pieceIds.mid(delta.firstPiece, delta.numPieces));
+  }
+}
+
+/**
+ * @brief EraseCommand::mergeWith appends the deltas of the next step of the same eraser gesture, which has already been applied.
+ */
+bool EraseCommand::mergeWith(const QUndoCommand *other)
+{
+  if (other->id() != id())
+    return false;
+  const EraseCommand *eraseCommand = static_cast<const EraseCommand *>(other);
+  int pieceOffset = m_pieces.size();
+  for (Delta delta : eraseCommand->m_deltas)
+  {
+    delta.firstPiece += pieceOffset;
+    m_deltas.append(delta);
+  }
+  m_pieces += eraseCommand->m_pieces;
+  m_pieceIds += eraseCommand->m_pieceIds;
+
+  return true;
+}
+
 /******************************************************************************
 ** CreateSelectionCommand
 */
@@ -127,28 +230,30 @@ CreateSelectionCommand::CreateSelectionCommand(Widget *widget, int pageNum, MrDo
   m_selection = selection;
   m_selectionPolygon = selection.selectionPolygon();
 
-  m_strokesAndPositions = widget->currentDocument.pages[pageNum].getStrokes(m_selectionPolygon);
+  m_strokesAndIds = widget->currentDocument.pages[pageNum].getStrokes(m_selectionPolygon);
 
-  for (auto sAndP : m_strokesAndPositions)
+  // getStrokes() returns the strokes back to front
+  for (int i = m_strokesAndIds.size() - 1; i >= 0; --i)
   {
-    m_selection.prependStroke(sAndP.first);
+    m_selection.appendStroke(m_strokesAndIds.at(i).first);
   }
+  m_selection.setSource(pageNum, m_strokesAndIds);
   m_selection.finalize();
   m_selection.updateBuffer(m_widget->zoom);
 }
 
 void CreateSelectionCommand::undo()
 {
-  m_widget->currentDocument.pages[m_pageNum].insertStrokes(m_strokesAndPositions);
-
+  // the journal still has the strokes on the page, see ReleaseSelectionCommand
+  m_widget->currentDocument.pages[m_pageNum].restoreStrokes(m_strokesAndIds);
   m_widget->setCurrentState(Widget::state::IDLE);
 }
 
 void CreateSelectionCommand::redo()
 {
-  for (auto &sAndP : m_strokesAndPositions)
+  for (auto &sAndId : m_strokesAndIds)
   {
-    m_widget->currentDocument.pages[m_pageNum].removeStrokeAt(sAndP.second);
+    m_widget->currentDocument.pages[m_pageNum].removeStroke(sAndId.second);
   }
   m_widget->currentSelection = m_selection;
   m_widget->setCurrentState(Widget::state::SELECTED);
@@ -170,9 +275,12 @@ ReleaseSelectionCommand::ReleaseSelectionCommand(Widget *newWidget, int newPageN
 void ReleaseSelectionCommand::undo()
 {
   widget->currentSelection = selection;
-  for (int i = 0; i < widget->currentSelection.strokes().size(); ++i)
+  widget->currentDocument.pages[pageNum].removeStrokes(strokeIds);
+  widget->journal.strokesRemoved(pageNum, strokeIds);
+  int sourcePageNum = selection.sourcePageNum();
+  if (sourcePageNum != -1)
   {
-    widget->currentDocument.pages[pageNum].removeLastStroke();
+    widget->journal.strokesRestored(sourcePageNum, widget->currentDocument.pages[sourcePageNum], selection.sourceStrokes());
   }
   widget->setCurrentState(Widget::state::SELECTED);
 }
@@ -180,7 +288,20 @@ void ReleaseSelectionCommand::undo()
 void ReleaseSelectionCommand::redo()
 {
   int pageNum = widget->currentSelection.pageNum();
-  widget->currentDocument.pages[pageNum].appendStrokes(widget->currentSelection.strokes());
+  if (strokeIds.isEmpty())
+  {
+    strokeIds = widget->currentDocument.pages[pageNum].appendStrokes(widget->currentSelection.strokes());
+  }
+  else
+  {
+    widget->currentDocument.pages[pageNum].restoreStrokes(selection.strokes(), strokeIds);
+  }
+  // the selected strokes leave their old place in the journal only now, so a crash while they are selected doesn't lose them
+  if (selection.sourcePageNum() != -1)
+  {
+    widget->journal.strokesRemoved(selection.sourcePageNum(), selection.sourceIds());
+  }
+  widget->journal.strokesAdded(pageNum, widget->currentDocument.pages[pageNum], strokeIds);
   widget->setCurrentState(Widget::state::IDLE);
 }
 
@@ -310,7 +431,9 @@ AddPageCommand::AddPageCommand(Widget *newWidget, int newPageNum, QUndoCommand *
 void AddPageCommand::undo()
 {
   widget->currentDocument.pages.removeAt(pageNum);
-  widget->pageBuffer.removeAt(pageNum);
+  widget->journal.pageRemoved(pageNum);
+  widget->pageCache.removePage(pageNum);
+  widget->updatePageOffsets();
   widget->update();
 }
 
@@ -329,8 +452,9 @@ void AddPageCommand::redo()
   page.setBackgroundColor(widget->currentDocument.pages[pageNumForSettings].backgroundColor());
 
   widget->currentDocument.pages.insert(pageNum, page);
-  widget->pageBuffer.insert(pageNum, QPixmap());
-  widget->updateBuffer(pageNum);
+  widget->journal.pageInserted(pageNum, page);
+  widget->pageCache.insertPage(pageNum);
+  widget->updatePageOffsets();
   widget->update();
 }
 
@@ -349,15 +473,18 @@ RemovePageCommand::RemovePageCommand(Widget *newWidget, int newPageNum, QUndoCom
 void RemovePageCommand::undo()
 {
   widget->currentDocument.pages.insert(pageNum, page);
-  widget->pageBuffer.insert(pageNum, QPixmap());
-  widget->updateBuffer(pageNum);
+  widget->journal.pageInserted(pageNum, page);
+  widget->pageCache.insertPage(pageNum);
+  widget->updatePageOffsets();
   widget->update();
 }
 
 void RemovePageCommand::redo()
 {
   widget->currentDocument.pages.removeAt(pageNum);
-  widget->pageBuffer.removeAt(pageNum);
+  widget->journal.pageRemoved(pageNum);
+  widget->pageCache.removePage(pageNum);
+  widget->updatePageOffsets();
   widget->update();
 }
 
@@ -402,13 +529,24 @@ CutCommand::CutCommand(Widget *newWidget, QUndoCommand *parent) : QUndoCommand(p
 
 void CutCommand::undo()
 {
+  int sourcePageNum = previousSelection.sourcePageNum();
+  if (previousState == Widget::state::SELECTED && sourcePageNum != -1)
+  {
+    widget->journal.strokesRestored(sourcePageNum, widget->currentDocument.pages[sourcePageNum], previousSelection.sourceStrokes());
+  }
   widget->currentSelection = previousSelection;
   widget->setCurrentState(previousState);
 }
 
 void CutCommand::redo()
 {
+  // the cut strokes were still on their page in the journal
+  if (previousState == Widget::state::SELECTED && previousSelection.sourcePageNum() != -1)
+  {
+    widget->journal.strokesRemoved(previousSelection.sourcePageNum(), previousSelection.sourceIds());
+  }
   widget->clipboard = previousSelection;
+  widget->clipboard.clearSource();
   widget->currentSelection = MrDoc::Selection();
   widget->setCurrentState(Widget::state::IDLE);
 }
@@ -435,6 +573,7 @@ void ChangePageSettingsCommand::undo()
   widget->currentDocument.pages[pageNum].setWidth(width);
   widget->currentDocument.pages[pageNum].setHeight(height);
   widget->currentDocument.pages[pageNum].setBackgroundColor(prevBackgroundColor);
+  widget->journal.pageChanged(pageNum, widget->currentDocument.pages[pageNum]);
   widget->updateBuffer(pageNum);
   widget->setGeometry(widget->getWidgetGeometry());
 }
@@ -446,6 +585,7 @@ void ChangePageSettingsCommand::redo()
   widget->currentDocument.pages[pageNum].setWidth(width);
   widget->currentDocument.pages[pageNum].setHeight(height);
   widget->currentDocument.pages[pageNum].setBackgroundColor(backgroundColor);
+  widget->journal.pageChanged(pageNum, widget->currentDocument.pages[pageNum]);
   widget->updateBuffer(pageNum);
   widget->setGeometry(widget->getWidgetGeometry());
 }
@@ -9,15 +9,15 @@
 class AddStrokeCommand : public QUndoCommand
 {
 public:
-  AddStrokeCommand(Widget *newWidget, int newPageNum, const MrDoc::Stroke &newStroke, int newStrokeNum = -1, bool newUpdate = true,
-                   bool newUpdateSuccessive = true, QUndoCommand *parent = 0);
+  AddStrokeCommand(Widget *newWidget, int newPageNum, const MrDoc::Stroke &newStroke, bool newUpdate = true, bool newUpdateSuccessive = true,
+                   QUndoCommand *parent = 0);
   void undo() Q_DECL_OVERRIDE;
   void redo() Q_DECL_OVERRIDE;
 
 private:
   Widget *widget;
   MrDoc::Stroke stroke;
-  int strokeNum;
+  MrDoc::StrokeId strokeId = 0; // assigned by the page on the first redo
   int pageNum;
   bool update;
   bool updateSuccessive;
@@ -33,11 +33,43 @@ public:
 private:
   Widget *widget;
   MrDoc::Stroke stroke;
-  int strokeNum;
+  MrDoc::StrokeId strokeId;
   int pageNum;
   bool update;
 };
 
+/**
+ * @brief The EraseCommand class removes the strokes hit by the eraser and puts in what is left of them. All steps of an eraser gesture are merged
+ * into one command, which keeps a compact record of every replaced stroke.
+ */
+class EraseCommand : public QUndoCommand
+{
+public:
+  EraseCommand(Widget *widget, int pageNum, const QVector<MrDoc::Eraser::Hit> &hits, QUndoCommand *parent = 0);
+  void undo() Q_DECL_OVERRIDE;
+  void redo() Q_DECL_OVERRIDE;
+  int id() const Q_DECL_OVERRIDE
+  {
+    return 2;
+  }
+  bool mergeWith(const QUndoCommand *other) Q_DECL_OVERRIDE;
+
+private:
+  struct Delta
+  {
+    int pageNum;
+    MrDoc::StrokeId strokeId;
+    MrDoc::Stroke stroke; // the stroke that was erased
+    int firstPiece;       // index into m_pieces
+    int numPieces;
+  };
+
+  Widget *m_widget;
+  QVector<Delta> m_deltas;
+  QVector<MrDoc::Stroke> m_pieces;
+  QVector<MrDoc::StrokeId> m_pieceIds; // assigned by the page on the first redo
+};
+
 class CreateSelectionCommand : public QUndoCommand
 {
 public:
@@ -48,7 +80,7 @@ public:
 private:
   Widget *m_widget;
   QPolygonF m_selectionPolygon;
-  QVector<QPair<MrDoc::Stroke, int>> m_strokesAndPositions;
+  QVector<QPair<MrDoc::Stroke, MrDoc::StrokeId>> m_strokesAndIds;
   MrDoc::Selection m_selection;
   int m_pageNum;
 };
@@ -63,6 +95,7 @@ public:
 private:
   Widget *widget;
   MrDoc::Selection selection;
+  QVector<MrDoc::StrokeId> strokeIds; // assigned by the page on the first redo
   int pageNum;
 };
 
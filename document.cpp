@@ -1,6 +1,9 @@
 #include "document.h"
+#include "filesync.h"
 
-#include "qcompressor.h"
+#include "gzipdevice.h"
+#include "numberparser.h"
+#include "pageloader.h"
 #include "version.h"
 
 #include <QPdfWriter>
@@ -10,9 +13,20 @@
 #include <QXmlStreamReader>
 #include <QFile>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QHash>
+#include <QSettings>
 #include <QErrorMessage>
 //#include <QSvgGenerator>
 #include <QDebug>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <QQueue>
+#include <QScopedPointer>
+
+#include <cstring>
+#include <limits>
 
 #include <zlib.h>
 
@@ -21,6 +35,546 @@
 namespace MrDoc
 {
 
+namespace
+{
+/**
+ * @brief readElementNumbers reads the text of the current element as a list of numbers, like readElementText() but without creating strings.
+ * @param reader has to be at a start element, and is left at the matching end element
+ * @param numbers
+ */
+void readElementNumbers(QXmlStreamReader &reader, QVector<float> &numbers)
+{
+  NumberParser parser;
+  while (!reader.atEnd() && reader.readNext() != QXmlStreamReader::EndElement)
+  {
+    if (reader.isCharacters())
+    {
+      parser.addText(reader.text(), numbers);
+    }
+  }
+  parser.finish(numbers);
+}
+
+/**
+ * @brief splitCoordinates splits alternating x and y coordinates, a trailing x without y is dropped.
+ * @param coordinates
+ * @param xs
+ * @param ys
+ */
+void splitCoordinates(const QVector<float> &coordinates, QVector<float> &xs, QVector<float> &ys)
+{
+  int n = coordinates.size() / 2;
+  xs.resize(n);
+  ys.resize(n);
+  for (int i = 0; i < n; ++i)
+  {
+    xs[i] = coordinates.at(2 * i);
+    ys[i] = coordinates.at(2 * i + 1);
+  }
+}
+
+/**
+ * @brief compressionLevel
+ * @return the gzip level for saving from the setting Document/compressionLevel, 0 to 9, or -1 for the zlib default
+ */
+int compressionLevel()
+{
+  QSettings settings;
+  return qBound(-1, settings.value("Document/compressionLevel", -1).toInt(), 9);
+}
+
+/**
+ * @brief The DocumentFile class reads a document file, which is decompressed while it is read if it is gzipped.
+ */
+class DocumentFile
+{
+public:
+  explicit DocumentFile(const QString &fileName) : m_file(fileName)
+  {
+  }
+
+  bool open()
+  {
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+      return false;
+    }
+    QByteArray magic = m_file.peek(2);
+    if (magic.size() < 2)
+    {
+      return false;
+    }
+    if (magic.at(0) == static_cast<char>(0x1f) && magic.at(1) == static_cast<char>(0x8b))
+    {
+      // this is a gzipped file
+      m_gzip.reset(new GzipDevice(&m_file));
+      return m_gzip->open(QIODevice::ReadOnly);
+    }
+    return true;
+  }
+
+  QIODevice &device()
+  {
+    if (m_gzip)
+    {
+      return *m_gzip;
+    }
+    return m_file;
+  }
+
+  bool hasError() const
+  {
+    return m_gzip && m_gzip->hasError();
+  }
+
+private:
+  QFile m_file;
+  QScopedPointer<GzipDevice> m_gzip; // declared behind m_file, so it is closed first
+};
+
+enum class PageElement
+{
+  Found,      // from start to end
+  Incomplete, // starts at start, but isn't closed before the end of the data
+  None        // no page starts behind from
+};
+
+/**
+ * @brief findPageElement finds the next page element in the data of a document without parsing it. Pages are never nested and a '<' in text or
+ * attributes is always escaped, so looking for the tags is enough.
+ * @param data
+ * @param from where to start looking
+ * @param start
+ * @param end behind the page element
+ * @return
+ */
+PageElement findPageElement(const QByteArray &data, int from, int &start, int &end)
+{
+  while (true)
+  {
+    start = data.indexOf("<page", from);
+    if (start == -1)
+    {
+      return PageElement::None;
+    }
+    int nameEnd = start + 5;
+    if (nameEnd == data.size())
+    {
+      return PageElement::Incomplete;
+    }
+    char next = data.at(nameEnd);
+    if (next != ' ' && next != '>' && next != '/' && next != '\n' && next != '\t' && next != '\r')
+    {
+      // some other element that starts with "page"
+      from = nameEnd;
+      continue;
+    }
+
+    int tagEnd = data.indexOf('>', nameEnd);
+    if (tagEnd == -1)
+    {
+      return PageElement::Incomplete;
+    }
+    if (data.at(tagEnd - 1) == '/')
+    {
+      end = tagEnd + 1; // an empty page
+      return PageElement::Found;
+    }
+    end = data.indexOf("</page>", tagEnd);
+    if (end == -1)
+    {
+      return PageElement::Incomplete;
+    }
+    end += 7;
+    return PageElement::Found;
+  }
+}
+
+// binary MOJ, all values are 32 bit and little endian
+const char binaryMOJMagic[] = "MRWB";
+const quint32 binaryMOJVersion = 1;
+const quint32 binaryMOJHeaderSize = 16;     // magic, format version, document version, offset of the tables
+const qint64 binaryMOJTablesOffsetPos = 12; // in the header
+
+void appendUInt32(QByteArray &out, quint32 value)
+{
+  value = qToLittleEndian(value);
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void appendFloat(QByteArray &out, float value)
+{
+  quint32 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  appendUInt32(out, bits);
+}
+
+void appendFloats(QByteArray &out, const float *values, int n)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  out.append(reinterpret_cast<const char *>(values), n * static_cast<int>(sizeof(float)));
+#else
+  for (int i = 0; i < n; ++i)
+  {
+    appendFloat(out, values[i]);
+  }
+#endif
+}
+
+/**
+ * @brief The BinaryReader class reads the values of a binary MOJ. Reading past the end yields zeros and clears ok().
+ */
+class BinaryReader
+{
+public:
+  explicit BinaryReader(const QByteArray &data) : m_data(data.constData()), m_size(data.size())
+  {
+  }
+
+  bool ok() const
+  {
+    return m_ok;
+  }
+
+  quint32 readUInt32()
+  {
+    quint32 value = 0;
+    if (take(sizeof(value)))
+    {
+      std::memcpy(&value, m_data + m_pos - sizeof(value), sizeof(value));
+    }
+    return qFromLittleEndian(value);
+  }
+
+  float readFloat()
+  {
+    quint32 bits = readUInt32();
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  void seek(quint32 pos)
+  {
+    if (pos > static_cast<quint32>(m_size))
+    {
+      m_ok = false;
+      return;
+    }
+    m_pos = static_cast<int>(pos);
+  }
+
+  void readFloats(QVector<float> &values, quint32 n)
+  {
+    if (n > static_cast<quint32>(m_size - m_pos) / sizeof(float) || !take(n * sizeof(float)))
+    {
+      m_ok = false;
+      values.clear();
+      return;
+    }
+    values.resize(n);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    std::memcpy(values.data(), m_data + m_pos - n * sizeof(float), n * sizeof(float));
+#else
+    const char *src = m_data + m_pos - n * sizeof(float);
+    for (quint32 i = 0; i < n; ++i)
+    {
+      quint32 bits;
+      std::memcpy(&bits, src + i * sizeof(float), sizeof(bits));
+      bits = qFromLittleEndian(bits);
+      std::memcpy(&values[i], &bits, sizeof(float));
+    }
+#endif
+  }
+
+private:
+  bool take(int size)
+  {
+    if (!m_ok || size > m_size - m_pos)
+    {
+      m_ok = false;
+      return false;
+    }
+    m_pos += size;
+    return true;
+  }
+
+  const char *m_data;
+  int m_size;
+  int m_pos = 0;
+  bool m_ok = true;
+};
+
+/**
+ * @brief binaryMOJChunk encodes a page for a binary MOJ.
+ * @param page
+ * @param styles the styles of the file, new styles of the page are appended
+ * @param fileStyles maps the StyleTable index of every style in styles to its index in styles
+ * @return the chunk of the page
+ */
+QByteArray binaryMOJChunk(const Page &page, QVector<int> &styles, QHash<int, quint32> &fileStyles)
+{
+  int numStrokes = 0;
+  int chunkSize = 16;
+  for (const Stroke &stroke : page.strokes())
+  {
+    if (!stroke.isEmpty())
+    {
+      ++numStrokes;
+      chunkSize += 12 + 12 * stroke.size();
+    }
+  }
+
+  QByteArray chunk;
+  chunk.reserve(chunkSize);
+  appendFloat(chunk, page.width());
+  appendFloat(chunk, page.height());
+  appendUInt32(chunk, page.backgroundColor().rgba());
+  appendUInt32(chunk, numStrokes);
+  for (const Stroke &stroke : page.strokes())
+  {
+    if (stroke.isEmpty())
+    {
+      continue; // tombstone of a removed stroke
+    }
+    if (!fileStyles.contains(stroke.style()))
+    {
+      fileStyles.insert(stroke.style(), styles.size());
+      styles.append(stroke.style());
+    }
+    appendUInt32(chunk, fileStyles.value(stroke.style()));
+    appendFloat(chunk, stroke.penWidth());
+    appendUInt32(chunk, stroke.size());
+    appendFloats(chunk, stroke.xData(), stroke.size());
+    appendFloats(chunk, stroke.yData(), stroke.size());
+    appendFloats(chunk, stroke.pressureData(), stroke.size());
+  }
+  return chunk;
+}
+
+/**
+ * @brief binaryMOJTables encodes the style table and the page table of a binary MOJ.
+ * @param styles
+ * @param pageTable
+ * @return the tables
+ */
+QByteArray binaryMOJTables(const QVector<int> &styles, const QVector<QPair<quint32, quint32>> &pageTable)
+{
+  QByteArray tables;
+  appendUInt32(tables, styles.size());
+  appendUInt32(tables, pageTable.size());
+  for (int style : styles)
+  {
+    StyleTable::Style fileStyle = StyleTable::instance().style(style);
+    appendUInt32(tables, fileStyle.color.rgba());
+    appendUInt32(tables, fileStyle.pattern.size());
+    for (qreal dash : fileStyle.pattern)
+    {
+      appendFloat(tables, dash);
+    }
+  }
+  for (const auto &chunk : pageTable)
+  {
+    appendUInt32(tables, chunk.first);
+    appendUInt32(tables, chunk.second);
+  }
+  return tables;
+}
+
+// line based MOJ, plain text with one line per page and per stroke
+const char lineBasedMOJMagic[] = "MrDoc;";
+
+/**
+ * @brief appendNumber writes a number with nine significant digits, the most a float needs to be read back exactly. Coordinates and pressures
+ * are floats, so they survive saving and loading unchanged, and a number that was loaded from a file is written back the same.
+ * @param out
+ * @param value
+ */
+void appendNumber(QByteArray &out, double value)
+{
+  out.append(QByteArray::number(value, 'g', 9));
+}
+
+/**
+ * @brief appendColor writes a color as #rrggbbaa, like the XML MOJ.
+ * @param out
+ * @param color
+ */
+void appendColor(QByteArray &out, const QColor &color)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+  const int components[] = {color.red(), color.green(), color.blue(), color.alpha()};
+  out.append('#');
+  for (int component : components)
+  {
+    out.append(hexDigits[component >> 4]);
+    out.append(hexDigits[component & 0xf]);
+  }
+}
+
+bool parseColor(const char *begin, const char *end, QColor &color)
+{
+  if (end - begin != 9 || *begin != '#')
+  {
+    return false;
+  }
+  bool ok;
+  uint rgba = QByteArray::fromRawData(begin + 1, 8).toUInt(&ok, 16);
+  color = QColor((rgba >> 24) & 0xff, (rgba >> 16) & 0xff, (rgba >> 8) & 0xff, rgba & 0xff);
+  return ok;
+}
+
+bool isWord(const char *begin, const char *end, const char *word)
+{
+  size_t length = std::strlen(word);
+  return static_cast<size_t>(end - begin) == length && std::strncmp(begin, word, length) == 0;
+}
+
+const char *patternName(const QVector<qreal> &pattern)
+{
+  if (pattern == MrDoc::dashLinePattern)
+  {
+    return "dash";
+  }
+  else if (pattern == MrDoc::dashDotLinePattern)
+  {
+    return "dashdot";
+  }
+  else if (pattern == MrDoc::dotLinePattern)
+  {
+    return "dot";
+  }
+  return "solid";
+}
+
+QVector<qreal> patternFromName(const char *begin, const char *end)
+{
+  if (isWord(begin, end, "dash"))
+  {
+    return MrDoc::dashLinePattern;
+  }
+  else if (isWord(begin, end, "dashdot"))
+  {
+    return MrDoc::dashDotLinePattern;
+  }
+  else if (isWord(begin, end, "dot"))
+  {
+    return MrDoc::dotLinePattern;
+  }
+  return MrDoc::solidLinePattern;
+}
+
+/**
+ * @brief nextField finds the next field of a line of a line based MOJ. Fields are separated by semicolons; the spaces around them don't belong
+ * to them.
+ * @param it where the field starts, moved behind its semicolon
+ * @param lineEnd
+ * @param fieldBegin
+ * @param fieldEnd
+ * @return false if there are no more fields
+ */
+bool nextField(const char *&it, const char *lineEnd, const char *&fieldBegin, const char *&fieldEnd)
+{
+  if (it == lineEnd)
+  {
+    return false;
+  }
+  const char *separator = static_cast<const char *>(std::memchr(it, ';', lineEnd - it));
+  fieldBegin = it;
+  fieldEnd = separator ? separator : lineEnd;
+  it = separator ? separator + 1 : lineEnd;
+  while (fieldBegin != fieldEnd && (*fieldBegin == ' ' || *fieldBegin == '\r'))
+  {
+    ++fieldBegin;
+  }
+  while (fieldEnd != fieldBegin && (*(fieldEnd - 1) == ' ' || *(fieldEnd - 1) == '\r'))
+  {
+    --fieldEnd;
+  }
+  return true;
+}
+
+/**
+ * @brief takeKey checks whether a field is a key:value pair with the given key, and if so moves begin to the value.
+ * @param begin
+ * @param end
+ * @param key
+ * @return
+ */
+bool takeKey(const char *&begin, const char *end, const char *key)
+{
+  size_t length = std::strlen(key);
+  if (static_cast<size_t>(end - begin) <= length || std::strncmp(begin, key, length) != 0 || begin[length] != ':')
+  {
+    return false;
+  }
+  begin += length + 1;
+  while (begin != end && *begin == ' ')
+  {
+    ++begin;
+  }
+  return true;
+}
+
+/**
+ * @brief lineBasedMOJPage writes a page and its strokes as lines. It only depends on the page, so pages can be written in parallel, and a stroke
+ * that didn't change always gives the same line.
+ * @param page
+ * @return
+ */
+QByteArray lineBasedMOJPage(const Page &page)
+{
+  int size = 96;
+  for (const Stroke &stroke : page.strokes())
+  {
+    size += stroke.isEmpty() ? 0 : 64 + 30 * stroke.size();
+  }
+
+  QByteArray out;
+  out.reserve(size);
+  out.append("Page; width:");
+  appendNumber(out, page.width());
+  out.append("; height:");
+  appendNumber(out, page.height());
+  out.append("; style:solid; color:");
+  appendColor(out, page.backgroundColor());
+  out.append('\n');
+
+  for (const Stroke &stroke : page.strokes())
+  {
+    if (stroke.isEmpty())
+    {
+      continue; // tombstone of a removed stroke
+    }
+    out.append("Stroke; ");
+    appendColor(out, stroke.color());
+    out.append("; ");
+    out.append(patternName(stroke.pattern()));
+    out.append("; ");
+    appendNumber(out, stroke.penWidth());
+    out.append("; points:");
+    const float *xs = stroke.xData();
+    const float *ys = stroke.yData();
+    const float *pressures = stroke.pressureData();
+    for (int k = 0; k < stroke.size(); ++k)
+    {
+      out.append(' ');
+      appendNumber(out, xs[k]);
+      out.append(' ');
+      appendNumber(out, ys[k]);
+    }
+    out.append(" ; pressure:");
+    for (int k = 0; k < stroke.size(); ++k)
+    {
+      out.append(' ');
+      appendNumber(out, pressures[k]);
+    }
+    out.append('\n');
+  }
+  return out;
+}
+}
+
 Document::Document()
 {
   for (int i = 0; i < 1; ++i)
@@ -31,12 +585,15 @@ Document::Document()
   setDocumentChanged(false);
 }
 
+/**
+ * @brief Document::Document copies doc. The pages are shared until either document changes them, so this is cheap enough to take a snapshot for
+ * saving in the background.
+ * @param doc
+ */
 Document::Document(const Document &doc)
+    : pages(doc.pages), m_documentChanged(doc.m_documentChanged), m_revision(doc.m_revision), m_docName(doc.m_docName), m_path(doc.m_path),
+      m_binaryLayout(doc.m_binaryLayout), m_pageLoaders(doc.m_pageLoaders)
 {
-  for (int i = 0; i < doc.pages.size(); ++i)
-  {
-    pages.append(doc.pages.at(i));
-  }
 }
 
 void Document::paintPage(int pageNum, QPainter &painter, qreal zoom)
@@ -113,46 +670,160 @@ void Document::exportPDF(QString fileName)
   painter.end();
 }
 
-bool Document::loadXOJ(QString fileName)
+/**
+ * @brief Document::streamPages decodes the pages of an XML document while it is read, so that neither the compressed nor the uncompressed
+ * document is ever held in memory as a whole. Every page element is copied out of the data as soon as it is complete and decoded on the thread
+ * pool. Only a few pages per thread are in flight, so besides the decoded pages, memory is bounded by the size of the largest page.
+ * @param device the rest of the document is read from
+ * @param data the start of the document, which was read already. Is left with everything in front of the first page, which is the root element.
+ * @param jobs gets one job per page, with the decoded page but without the page element
+ * @param loadPage decodes a page element, on the thread pool
+ * @return false if the document could not be read or a page isn't closed
+ */
+bool Document::streamPages(QIODevice &device, QByteArray &data, QVector<PageJob> &jobs, const std::function<bool(const QByteArray &, Page &)> &loadPage)
 {
-  QFile file(fileName);
-  if (!file.open(QIODevice::ReadOnly))
+  const int readSize = 256 * 1024;
+  const int maxPendingJobs = 2 * qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  QQueue<QFuture<PageJob>> pendingJobs;
+  auto finishJob = [&pendingJobs, &jobs]()
   {
-    return false;
-  }
-
-  QXmlStreamReader reader;
-
-  // check if it is a gzipped xoj
-  QByteArray s = file.read(2);
-  if (s.size() == 2)
+    PageJob job = pendingJobs.dequeue().result();
+    job.data = QByteArray(); // the decoded page is all that is kept
+    jobs.append(job);
+  };
+
+  QByteArray header;
+  bool headerFound = false;
+  qint64 dropped = 0; // from the front of data
+  int from = 0;       // where the next page is looked for
+  bool success = true;
+  while (true)
   {
-    if (s.at(0) == static_cast<char>(0x1f) && s.at(1) == static_cast<char>(0x8b))
+    int start = 0;
+    int end = 0;
+    PageElement element = findPageElement(data, from, start, end);
+    if (element == PageElement::Found)
     {
-      // this is a gzipped file
-      file.reset();
-      QByteArray compressedData = file.readAll();
-      QByteArray uncompressedData;
-      if (!QCompressor::gzipDecompress(compressedData, uncompressedData))
+      if (!headerFound)
       {
-        return false;
+        header = data.left(start);
+        headerFound = true;
       }
-      reader.addData(uncompressedData);
+      PageJob job;
+      job.offset = static_cast<int>(dropped + start);
+      job.data = data.mid(start, end - start);
+      job.ok = false;
+      pendingJobs.enqueue(QtConcurrent::run([loadPage, job]() mutable
+                                            {
+                                              job.ok = loadPage(job.data, job.page);
+                                              return job;
+                                            }));
+      while (pendingJobs.size() > maxPendingJobs)
+      {
+        finishJob();
+      }
+      from = end;
+      continue;
     }
-    else
+
+    // everything in front of an incomplete page or of a tag that might be cut off is done with
+    from = (element == PageElement::Incomplete) ? start : qMax(from, data.size() - 4);
+    if (headerFound)
     {
-      file.reset();
-      reader.setDevice(&file);
+      data.remove(0, from);
+      dropped += from;
+      from = 0;
+    }
+
+    // reading at least as much as is there already keeps an incomplete page from being searched over and over
+    int oldSize = data.size();
+    int size = qMax(readSize, oldSize - from);
+    data.resize(oldSize + size);
+    qint64 bytesRead = device.read(data.data() + oldSize, size);
+    data.resize(oldSize + static_cast<int>(qMax(bytesRead, static_cast<qint64>(0))));
+    if (bytesRead <= 0)
+    {
+      success = bytesRead == 0 && element == PageElement::None;
+      break;
     }
   }
-  else
+
+  while (!pendingJobs.isEmpty())
   {
-    return false;
+    finishJob();
+  }
+  if (headerFound)
+  {
+    data = header;
+  }
+  return success;
+}
+
+/**
+ * @brief Document::collectPages replaces the pages of the document with the decoded pages, if all of them could be read.
+ * @param jobs
+ * @return
+ */
+bool Document::collectPages(const QVector<PageJob> &jobs)
+{
+  for (const PageJob &job : jobs)
+  {
+    if (!job.ok)
+    {
+      return false;
+    }
   }
 
   pages.clear();
+  pages.reserve(jobs.size());
+  for (const PageJob &job : jobs)
+  {
+    pages.append(job.page);
+  }
+  return true;
+}
 
-  int strokeCount = 0;
+bool Document::loadXOJ(QString fileName)
+{
+  m_binaryLayout = BinaryLayout();
+  DocumentFile file(fileName);
+  if (!file.open())
+  {
+    return false;
+  }
+
+  QByteArray data;
+  QVector<PageJob> jobs;
+  if (!streamPages(file.device(), data, jobs, [this](const QByteArray &pageData, Page &page) { return loadXOJPage(pageData, page); }) ||
+      file.hasError())
+  {
+    return false;
+  }
+
+  if (!collectPages(jobs))
+  {
+    return false;
+  }
+  setDocumentChanged(true);
+  return true;
+}
+
+/**
+ * @brief Document::loadXOJPage decodes a single page of a xournal document.
+ * @param data the page element
+ * @param page
+ * @return false if the page could not be read
+ */
+bool Document::loadXOJPage(const QByteArray &data, Page &page)
+{
+  QXmlStreamReader reader(data);
+
+  // reused for all strokes, so parsing a stroke doesn't allocate
+  QVector<float> widths;
+  QVector<float> coordinates;
+  QVector<float> xs;
+  QVector<float> ys;
+  QVector<float> pressures;
 
   while (!reader.atEnd())
   {
@@ -162,18 +833,15 @@ bool Document::loadXOJ(QString fileName)
       QXmlStreamAttributes attributes = reader.attributes();
       QStringRef width = attributes.value("", "width");
       QStringRef height = attributes.value("", "height");
-      Page newPage;
-      newPage.setWidth(width.toDouble());
-      newPage.setHeight(height.toDouble());
-
-      pages.append(newPage);
+      page.setWidth(width.toDouble());
+      page.setHeight(height.toDouble());
     }
     if (reader.name() == "background" && reader.tokenType() == QXmlStreamReader::StartElement)
     {
       QXmlStreamAttributes attributes = reader.attributes();
       QStringRef color = attributes.value("", "color");
       QColor newColor = stringToColor(color.toString());
-      pages.last().setBackgroundColor(newColor);
+      page.setBackgroundColor(newColor);
     }
     if (reader.name() == "stroke" && reader.tokenType() == QXmlStreamReader::StartElement)
     {
@@ -181,71 +849,61 @@ bool Document::loadXOJ(QString fileName)
       QStringRef tool = attributes.value("", "tool");
       if (tool == "pen")
       {
-        Stroke newStroke;
-        newStroke.pattern = MrDoc::solidLinePattern;
         QStringRef color = attributes.value("", "color");
-        newStroke.color = stringToColor(color.toString());
-        QStringRef strokeWidth = attributes.value("", "width");
-        QStringList strokeWidthList = strokeWidth.toString().split(" ");
-        newStroke.penWidth = strokeWidthList.at(0).toDouble();
-        newStroke.pressures.append(newStroke.penWidth / strokeWidthList.at(0).toDouble());
-        for (int i = 1; i < strokeWidthList.size(); ++i)
+        int style = StyleTable::instance().intern(stringToColor(color.toString()), MrDoc::solidLinePattern);
+        widths.clear();
+        NumberParser::parse(attributes.value("", "width"), widths);
+        if (widths.isEmpty())
         {
-          newStroke.pressures.append(2 * strokeWidthList.at(i).toDouble() / newStroke.penWidth - newStroke.pressures.at(i - 1));
+          widths.append(0.0f);
         }
-        QString elementText = reader.readElementText();
-        QStringList elementTextList = elementText.split(" ");
-        for (int i = 0; i + 1 < elementTextList.size(); i = i + 2)
+        qreal penWidth = widths.at(0);
+        // xournal stores the width of each segment, the pressure at the points is recovered from the mean of neighbouring ones
+        pressures.clear();
+        pressures.append(1.0f);
+        for (int i = 1; i < widths.size(); ++i)
         {
-          newStroke.points.append(QPointF(elementTextList.at(i).toDouble(), elementTextList.at(i + 1).toDouble()));
+          pressures.append(2 * widths.at(i) / penWidth - pressures.at(i - 1));
         }
-        while (newStroke.points.size() > newStroke.pressures.size())
+        coordinates.clear();
+        readElementNumbers(reader, coordinates);
+        splitCoordinates(coordinates, xs, ys);
+        while (xs.size() > pressures.size())
         {
-          newStroke.pressures.append(1.0);
+          pressures.append(1.0f);
         }
-        pages.last().appendStroke(newStroke);
-        strokeCount++;
-        qDebug() << strokeCount;
+        pressures.resize(xs.size());
+        page.appendStroke(xs.constData(), ys.constData(), pressures.constData(), xs.size(), style, penWidth);
       }
     }
   }
 
-  //    QFileInfo fileInfo(file);
-  file.close();
-
-  for (auto &page : pages)
-  {
-    page.clearDirtyRect();
-  }
-
-  if (reader.hasError())
-  {
-    return false;
-  }
-  else
-  {
-    setDocumentChanged(true);
-    return true;
-  }
+  page.clearDirtyRect();
+  return !reader.hasError();
 }
 
 bool Document::saveXOJ(QString fileName)
 {
-  QFile file(fileName);
+  // the file might be the one lazily loaded pages are read from
+  loadAllPages();
+
+  // written to a temporary file that replaces the old one in commit(), so a failed save leaves the old file intact
+  QSaveFile file(fileName);
   if (!file.open(QIODevice::WriteOnly))
   {
     return false;
   }
 
-  QByteArray uncompressedData;
-
-  QXmlStreamWriter writer(&uncompressedData);
-  //  QXmlStreamWriter writer;
+  // compressed while it is written, so the uncompressed document is never held in memory
+  GzipDevice gzip(&file, compressionLevel());
+  if (!gzip.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  QXmlStreamWriter writer(&gzip);
 
   writer.setAutoFormatting(true);
 
-  //  writer.setDevice(&file);
-
   writer.writeStartDocument("1.0", false);
   writer.writeStartElement("xournal");
   writer.writeAttribute(QXmlStreamAttribute("version", "0.4.8"));
@@ -266,27 +924,31 @@ bool Document::saveXOJ(QString fileName)
     writer.writeStartElement("layer");
 
     //    for (int j = 0; j < pages[i].m_strokes.size(); ++j)
-    for (auto strokes : pages[i].strokes())
+    for (const Stroke &strokes : pages[i].strokes())
     {
+      if (strokes.isEmpty())
+      {
+        continue; // tombstone of a removed stroke
+      }
       writer.writeStartElement("stroke");
       writer.writeAttribute(QXmlStreamAttribute("tool", "pen"));
-      writer.writeAttribute(QXmlStreamAttribute("color", toRGBA(strokes.color.name(QColor::HexArgb))));
-      qreal width = strokes.penWidth;
+      writer.writeAttribute(QXmlStreamAttribute("color", toRGBA(strokes.color().name(QColor::HexArgb))));
+      qreal width = strokes.penWidth();
       QString widthString;
       widthString.append(QString::number(width));
-      for (int k = 0; k < strokes.pressures.size() - 1; ++k)
+      for (int k = 0; k < strokes.size() - 1; ++k)
       {
-        qreal p0 = strokes.pressures[k];
-        qreal p1 = strokes.pressures[k + 1];
+        qreal p0 = strokes.pressure(k);
+        qreal p1 = strokes.pressure(k + 1);
         widthString.append(' ');
         widthString.append(QString::number(0.5 * (p0 + p1) * width));
       }
       writer.writeAttribute(QXmlStreamAttribute("width", widthString));
-      for (int k = 0; k < strokes.points.size(); ++k)
+      for (int k = 0; k < strokes.size(); ++k)
       {
-        writer.writeCharacters(QString::number(strokes.points[k].x()));
+        writer.writeCharacters(QString::number(strokes.point(k).x()));
         writer.writeCharacters(" ");
-        writer.writeCharacters(QString::number(strokes.points[k].y()));
+        writer.writeCharacters(QString::number(strokes.point(k).y()));
         writer.writeCharacters(" ");
       }
       writer.writeEndElement(); // closing "stroke"
@@ -297,18 +959,9 @@ bool Document::saveXOJ(QString fileName)
   }
 
   writer.writeEndDocument();
+  gzip.close();
 
-  QByteArray compressedData;
-
-  QCompressor::gzipCompress(uncompressedData, compressedData);
-
-  file.write(compressedData);
-
-  //  QFileInfo fileInfo(file);
-
-  file.close();
-
-  if (writer.hasError())
+  if (writer.hasError() || gzip.hasError() || !file.commit())
   {
     return false;
   }
@@ -320,74 +973,135 @@ bool Document::saveXOJ(QString fileName)
 
 bool Document::loadMOJ(QString fileName)
 {
-  QFile file(fileName);
-  if (!file.open(QIODevice::ReadOnly))
+  m_binaryLayout = BinaryLayout();
+  m_pageLoaders.clear();
+  QVector<PageJob> jobs;
+  QVector<int> styles; // of a binary MOJ
+  bool binary = false;
+  QByteArray data;
+  DocumentFile file(fileName);
+  QSharedPointer<MappedFile> mappedFile(new MappedFile(fileName));
+  if (mappedFile->isMapped() && mappedFile->data().startsWith(binaryMOJMagic))
+  {
+    binary = true;
+    if (!splitMappedMOJ(mappedFile, jobs, styles))
+    {
+      return false;
+    }
+  }
+  else if (!file.open())
   {
     return false;
   }
-
-  QXmlStreamReader reader;
-
-  // check if it is a gzipped moj
-  QByteArray s = file.read(2);
-  if (s.size() == 2)
+  else
   {
-    if (s.at(0) == static_cast<char>(0x1f) && s.at(1) == static_cast<char>(0x8b))
+    // the start of the file tells the format, only the XML format is decoded while it is read
+    data = file.device().read(16);
+    if (data.startsWith(binaryMOJMagic) || data.startsWith(lineBasedMOJMagic))
     {
-      // this is a gzipped file
-      file.reset();
-      QByteArray compressedData = file.readAll();
-      QByteArray uncompressedData;
-      if (!QCompressor::gzipDecompress(compressedData, uncompressedData))
+      data.append(file.device().readAll());
+      if (file.hasError())
+      {
+        return false;
+      }
+    }
+
+    if (data.startsWith(binaryMOJMagic))
+    {
+      binary = true;
+      if (!splitBinaryMOJ(data, jobs, styles))
+      {
+        return false;
+      }
+      QtConcurrent::blockingMap(jobs, [&styles](PageJob &job) { job.ok = loadBinaryMOJPage(job.data, job.page, styles); });
+    }
+    else if (data.startsWith(lineBasedMOJMagic))
+    {
+      if (!splitLineBasedMOJ(data, jobs))
       {
         return false;
       }
-      reader.addData(uncompressedData);
-    }
-    else
-    {
-      file.reset();
-      reader.setDevice(&file);
+      QtConcurrent::blockingMap(jobs, [](PageJob &job) { job.ok = loadLineBasedMOJPage(job.data, job.page); });
+    }
+    else
+    {
+      if (!streamPages(file.device(), data, jobs, [this](const QByteArray &pageData, Page &page) { return loadMOJPage(pageData, page); }) ||
+          file.hasError())
+      {
+        return false;
+      }
+
+      // the root element is all that comes before the first page
+      QXmlStreamReader root(data);
+      while (!root.atEnd())
+      {
+        root.readNext();
+        if (root.name() == "MrWriter" && root.tokenType() == QXmlStreamReader::StartElement)
+        {
+          QXmlStreamAttributes attributes = root.attributes();
+          QStringRef docversion = attributes.value("document-version");
+          if (docversion.toInt() > DOC_VERSION)
+          {
+            // TODO warn about newer document version
+          }
+          break;
+        }
+      }
     }
   }
-  else
+
+  if (!collectPages(jobs))
   {
     return false;
   }
+  if (binary)
+  {
+    PageTable pageTable;
+    for (const PageJob &job : jobs)
+    {
+      pageTable.append(qMakePair(static_cast<quint32>(job.offset), static_cast<quint32>(job.data.size())));
+    }
+    setBinaryLayout(fileName, styles, pageTable, true);
+  }
+  QFileInfo fileInfo(fileName);
+  m_path = fileInfo.absolutePath();
+  m_docName = fileInfo.completeBaseName();
+  return true;
+}
 
-  pages.clear();
+/**
+ * @brief Document::loadMOJPage decodes a single page of a MrWriter document.
+ * @param data the page element
+ * @param page
+ * @return false if the page could not be read
+ */
+bool Document::loadMOJPage(const QByteArray &data, Page &page)
+{
+  QXmlStreamReader reader(data);
 
-  int strokeCount = 0;
+  // reused for all strokes, so parsing a stroke doesn't allocate
+  QVector<float> coordinates;
+  QVector<float> xs;
+  QVector<float> ys;
+  QVector<float> pressures;
 
   while (!reader.atEnd())
   {
     reader.readNext();
-    if (reader.name() == "MrWriter" && reader.tokenType() == QXmlStreamReader::StartElement)
-    {
-      QXmlStreamAttributes attributes = reader.attributes();
-      QStringRef docversion = attributes.value("document-version");
-      if (docversion.toInt() > DOC_VERSION)
-      {
-        // TODO warn about newer document version
-      }
-    }
     if (reader.name() == "page" && reader.tokenType() == QXmlStreamReader::StartElement)
     {
       QXmlStreamAttributes attributes = reader.attributes();
       QStringRef width = attributes.value("", "width");
       QStringRef height = attributes.value("", "height");
-      Page newPage;
-      newPage.setWidth(width.toDouble());
-      newPage.setHeight(height.toDouble());
-
-      pages.append(newPage);
+      page.setWidth(width.toDouble());
+      page.setHeight(height.toDouble());
     }
     if (reader.name() == "background" && reader.tokenType() == QXmlStreamReader::StartElement)
     {
       QXmlStreamAttributes attributes = reader.attributes();
       QStringRef color = attributes.value("", "color");
       QColor newColor = stringToColor(color.toString());
-      pages.last().setBackgroundColor(newColor);
+      page.setBackgroundColor(newColor);
     }
     if (reader.name() == "stroke" && reader.tokenType() == QXmlStreamReader::StartElement)
     {
@@ -395,99 +1109,63 @@ bool Document::loadMOJ(QString fileName)
       QStringRef tool = attributes.value("", "tool");
       if (tool == "pen")
       {
-        Stroke newStroke;
-        newStroke.pattern = MrDoc::solidLinePattern;
         QStringRef color = attributes.value("", "color");
-        newStroke.color = stringToColor(color.toString());
         QStringRef style = attributes.value("", "style");
-        if (style.toString().compare("solid") == 0)
-        {
-          newStroke.pattern = MrDoc::solidLinePattern;
-        }
-        else if (style.toString().compare("dash") == 0)
+        QVector<qreal> pattern = MrDoc::solidLinePattern;
+        if (style == "dash")
         {
-          newStroke.pattern = MrDoc::dashLinePattern;
+          pattern = MrDoc::dashLinePattern;
         }
-        else if (style.toString().compare("dashdot") == 0)
+        else if (style == "dashdot")
         {
-          newStroke.pattern = MrDoc::dashDotLinePattern;
+          pattern = MrDoc::dashDotLinePattern;
         }
-        else if (style.toString().compare("dot") == 0)
+        else if (style == "dot")
         {
-          newStroke.pattern = MrDoc::dotLinePattern;
-        }
-        else
-        {
-          newStroke.pattern = MrDoc::solidLinePattern;
+          pattern = MrDoc::dotLinePattern;
         }
+        int strokeStyle = StyleTable::instance().intern(stringToColor(color.toString()), pattern);
         QStringRef strokeWidth = attributes.value("", "width");
-        newStroke.penWidth = strokeWidth.toDouble();
-        QString elementText = reader.readElementText();
-        QStringList elementTextList = elementText.trimmed().split(" ");
-        for (int i = 0; i + 1 < elementTextList.size(); i = i + 2)
-        {
-          newStroke.points.append(QPointF(elementTextList.at(i).toDouble(), elementTextList.at(i + 1).toDouble()));
-        }
-        QStringRef pressures = attributes.value("pressures");
-        QStringList pressuresList = pressures.toString().trimmed().split(" ");
-        for (int i = 0; i < pressuresList.length(); ++i)
-        {
-          if (pressuresList.length() == 0)
-          {
-            newStroke.pressures.append(1.0);
-          }
-          else
-          {
-            newStroke.pressures.append(pressuresList.at(i).toDouble());
-          }
-        }
-        if (newStroke.pressures.size() != newStroke.points.size())
+        pressures.clear();
+        NumberParser::parse(attributes.value("pressures"), pressures);
+        coordinates.clear();
+        readElementNumbers(reader, coordinates);
+        splitCoordinates(coordinates, xs, ys);
+        if (pressures.size() != xs.size())
         {
           return false;
         }
-        pages.last().appendStroke(newStroke);
-        strokeCount++;
-        qDebug() << strokeCount;
+        page.appendStroke(xs.constData(), ys.constData(), pressures.constData(), xs.size(), strokeStyle, strokeWidth.toDouble());
       }
     }
   }
 
-  QFileInfo fileInfo(file);
-  file.close();
-
-  for (auto &page : pages)
-  {
-    page.clearDirtyRect();
-  }
-
-  if (reader.hasError())
-  {
-    return false;
-  }
-  else
-  {
-    m_path = fileInfo.absolutePath();
-    m_docName = fileInfo.completeBaseName();
-    return true;
-  }
+  page.clearDirtyRect();
+  return !reader.hasError();
 }
 
 bool Document::saveMOJ(QString fileName)
 {
-  QFile file(fileName);
+  // the file might be the one lazily loaded pages are read from
+  loadAllPages();
+
+  // written to a temporary file that replaces the old one in commit(), so a failed save leaves the old file intact
+  QSaveFile file(fileName);
   if (!file.open(QIODevice::WriteOnly))
   {
     return false;
   }
 
-  QByteArray uncompressedData;
-
-  QXmlStreamWriter writer(&uncompressedData);
+  // compressed while it is written, so the uncompressed document is never held in memory
+  GzipDevice gzip(&file, compressionLevel());
+  if (!gzip.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  QXmlStreamWriter writer(&gzip);
 
   writer.setAutoFormatting(true);
 
-  //  writer.setDevice(&file);
-
   writer.writeStartDocument("1.0", false);
   writer.writeStartElement("MrWriter");
   QString version;
@@ -512,25 +1190,29 @@ bool Document::saveMOJ(QString fileName)
     writer.writeStartElement("layer");
 
     //    for (int j = 0; j < pages[i].m_strokes.size(); ++j)
-    for (auto strokes : pages[i].strokes())
+    for (const Stroke &strokes : pages[i].strokes())
     {
+      if (strokes.isEmpty())
+      {
+        continue; // tombstone of a removed stroke
+      }
       writer.writeStartElement("stroke");
       writer.writeAttribute(QXmlStreamAttribute("tool", "pen"));
-      writer.writeAttribute(QXmlStreamAttribute("color", toRGBA(strokes.color.name(QColor::HexArgb))));
+      writer.writeAttribute(QXmlStreamAttribute("color", toRGBA(strokes.color().name(QColor::HexArgb))));
       QString patternString;
-      if (strokes.pattern == MrDoc::solidLinePattern)
+      if (strokes.pattern() == MrDoc::solidLinePattern)
       {
         patternString = "solid";
       }
-      else if (strokes.pattern == MrDoc::dashLinePattern)
+      else if (strokes.pattern() == MrDoc::dashLinePattern)
       {
         patternString = "dash";
       }
-      else if (strokes.pattern == MrDoc::dashDotLinePattern)
+      else if (strokes.pattern() == MrDoc::dashDotLinePattern)
       {
         patternString = "dashdot";
       }
-      else if (strokes.pattern == MrDoc::dotLinePattern)
+      else if (strokes.pattern() == MrDoc::dotLinePattern)
       {
         patternString = "dot";
       }
@@ -539,20 +1221,20 @@ bool Document::saveMOJ(QString fileName)
         patternString = "solid";
       }
       writer.writeAttribute(QXmlStreamAttribute("style", patternString));
-      qreal width = strokes.penWidth;
+      qreal width = strokes.penWidth();
       writer.writeAttribute(QXmlStreamAttribute("width", QString::number(width)));
       QString pressures;
-      for (int k = 0; k < strokes.pressures.length(); ++k)
+      for (int k = 0; k < strokes.size(); ++k)
       {
-        pressures.append(QString::number(strokes.pressures[k])).append(" ");
+        pressures.append(QString::number(strokes.pressure(k))).append(" ");
       }
       writer.writeAttribute((QXmlStreamAttribute("pressures", pressures.trimmed())));
       QString points;
-      for (int k = 0; k < strokes.points.size(); ++k)
+      for (int k = 0; k < strokes.size(); ++k)
       {
-        points.append(QString::number(strokes.points[k].x()));
+        points.append(QString::number(strokes.point(k).x()));
         points.append(" ");
-        points.append(QString::number(strokes.points[k].y()));
+        points.append(QString::number(strokes.point(k).y()));
         points.append(" ");
       }
       writer.writeCharacters(points.trimmed());
@@ -564,22 +1246,18 @@ bool Document::saveMOJ(QString fileName)
   }
 
   writer.writeEndDocument();
+  gzip.close();
 
-  QByteArray compressedData;
-  QCompressor::gzipCompress(uncompressedData, compressedData);
-  file.write(compressedData);
-
-  QFileInfo fileInfo(file);
-
-  file.close();
+  QFileInfo fileInfo(fileName);
 
-  if (writer.hasError())
+  if (writer.hasError() || gzip.hasError() || !file.commit())
   {
     return false;
   }
   else
   {
     setDocumentChanged(false);
+    m_binaryLayout = BinaryLayout();
 
     m_path = fileInfo.absolutePath();
     m_docName = fileInfo.completeBaseName();
@@ -587,6 +1265,505 @@ bool Document::saveMOJ(QString fileName)
   }
 }
 
+/**
+ * @brief Document::saveBinaryMOJ saves the document in the binary MOJ format, which holds the same as the XML format but stores coordinates and
+ * pressures as float arrays that are copied as they are when loading.
+ * @details Layout, all values are 32 bit little endian:
+ * - header: "MRWB", format version, document version, offset of the tables
+ * - page chunks: width, height, ARGB background color, number of strokes and per stroke the style index, pen width, number of points and the
+ *   x coordinates, y coordinates and pressures as floats
+ * - tables: number of styles, number of pages, per style the ARGB color, the length of the pattern and the pattern as floats, and per page
+ *   the offset and size of its chunk in the file
+ *
+ * Pages are self-contained chunks, so they can be decoded in parallel.
+ * @param fileName
+ * @return
+ */
+bool Document::saveBinaryMOJ(QString fileName)
+{
+  // the file might be the one lazily loaded pages are read from
+  loadAllPages();
+
+  // written to a temporary file that replaces the old one in commit(), so a failed save leaves the old file intact
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+
+  QVector<int> styles; // index into the StyleTable of every style in the file
+  QHash<int, quint32> fileStyles;
+  QVector<QByteArray> chunks;
+  chunks.reserve(pages.size());
+  PageTable pageTable;
+  pageTable.reserve(pages.size());
+  quint32 offset = binaryMOJHeaderSize;
+  for (const Page &page : pages)
+  {
+    chunks.append(binaryMOJChunk(page, styles, fileStyles));
+    pageTable.append(qMakePair(offset, static_cast<quint32>(chunks.last().size())));
+    offset += chunks.last().size();
+  }
+
+  QByteArray header;
+  header.append(binaryMOJMagic, 4);
+  appendUInt32(header, binaryMOJVersion);
+  appendUInt32(header, DOC_VERSION);
+  appendUInt32(header, offset);
+  QByteArray tables = binaryMOJTables(styles, pageTable);
+
+  bool success = file.write(header) == header.size();
+  for (const QByteArray &chunk : chunks)
+  {
+    success = success && file.write(chunk) == chunk.size();
+  }
+  success = success && file.write(tables) == tables.size();
+
+  QFileInfo fileInfo(fileName);
+
+  if (!success || !file.commit())
+  {
+    return false;
+  }
+  setDocumentChanged(false);
+  m_path = fileInfo.absolutePath();
+  m_docName = fileInfo.completeBaseName();
+  setBinaryLayout(fileName, styles, pageTable, true);
+  return true;
+}
+
+/**
+ * @brief Document::updateBinaryMOJ saves the document to the binary MOJ it was loaded from or last saved to by writing only the pages that
+ * changed since, so a small edit of a large document saves in about the time of the edit.
+ * @details The chunks of the changed pages and new tables are appended to the file, and then the offset of the tables in the header is changed
+ * to point to them, so the file holds the old document until that last write. Both writes are synced to the disk before going on, so the header
+ * never points to tables that didn't make it there. The chunks and tables left behind are dropped by a full save with saveBinaryMOJ() once they
+ * take up more than half of the file. A full save is also done if the file isn't the one of the last load or save, or was changed by someone
+ * else since.
+ * @param fileName
+ * @return
+ */
+bool Document::updateBinaryMOJ(QString fileName)
+{
+  QFileInfo fileInfo(fileName);
+  if (m_binaryLayout.fileName.isEmpty() || m_binaryLayout.fileName != fileInfo.absoluteFilePath() || m_binaryLayout.fileSize != fileInfo.size() ||
+      m_binaryLayout.lastModified != fileInfo.lastModified().toMSecsSinceEpoch())
+  {
+    return saveBinaryMOJ(fileName);
+  }
+
+  // the styles of the file keep their indices, since the chunks that stay refer to them
+  QVector<int> styles = m_binaryLayout.styles;
+  QHash<int, quint32> fileStyles;
+  for (int i = 0; i < styles.size(); ++i)
+  {
+    fileStyles.insert(styles[i], i);
+  }
+
+  // pages whose generation is in the file keep their chunk and don't have to be loaded
+  quint64 end = static_cast<quint64>(m_binaryLayout.fileSize);
+  quint64 liveSize = binaryMOJHeaderSize;
+  QByteArray chunks;
+  PageTable pageTable;
+  pageTable.reserve(pages.size());
+  for (const Page &page : pages)
+  {
+    auto chunk = m_binaryLayout.chunks.constFind(page.generation());
+    if (chunk != m_binaryLayout.chunks.constEnd())
+    {
+      pageTable.append(chunk.value());
+    }
+    else
+    {
+      QByteArray data = binaryMOJChunk(page, styles, fileStyles);
+      pageTable.append(qMakePair(static_cast<quint32>(end + chunks.size()), static_cast<quint32>(data.size())));
+      chunks.append(data);
+    }
+    liveSize += pageTable.last().second;
+  }
+
+  quint64 tablesOffset = end + chunks.size();
+  QByteArray tables = binaryMOJTables(styles, pageTable);
+  liveSize += tables.size();
+  quint64 newSize = tablesOffset + tables.size();
+  if (newSize > 2 * liveSize || newSize > static_cast<quint64>(std::numeric_limits<int>::max()))
+  {
+    return saveBinaryMOJ(fileName);
+  }
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadWrite))
+  {
+    return false;
+  }
+
+  // a file of another format version is saved in full
+  QByteArray header = file.read(binaryMOJTablesOffsetPos);
+  QByteArray expectedHeader(binaryMOJMagic, 4);
+  appendUInt32(expectedHeader, binaryMOJVersion);
+  if (!header.startsWith(expectedHeader))
+  {
+    file.close();
+    return saveBinaryMOJ(fileName);
+  }
+
+  QByteArray offset;
+  appendUInt32(offset, static_cast<quint32>(tablesOffset));
+  bool success = file.seek(end) && file.write(chunks) == chunks.size() && file.write(tables) == tables.size() && syncFile(file);
+  success = success && file.seek(binaryMOJTablesOffsetPos) && file.write(offset) == offset.size() && syncFile(file);
+  file.close();
+  if (!success)
+  {
+    return false;
+  }
+
+  setDocumentChanged(false);
+  m_path = fileInfo.absolutePath();
+  m_docName = fileInfo.completeBaseName();
+  setBinaryLayout(fileName, styles, pageTable, false);
+  return true;
+}
+
+/**
+ * @brief Document::splitBinaryMOJ reads the header and the tables of a binary MOJ.
+ * @param data
+ * @param jobs gets one job per page, whose data refers to the chunk of the page in data
+ * @param styles gets the index into the StyleTable of every style of the file
+ * @return false if the file is damaged or from a newer version
+ */
+bool Document::splitBinaryMOJ(const QByteArray &data, QVector<PageJob> &jobs, QVector<int> &styles)
+{
+  BinaryReader reader(data);
+  reader.readUInt32(); // magic
+  quint32 version = reader.readUInt32();
+  quint32 docVersion = reader.readUInt32();
+  reader.seek(reader.readUInt32());
+  quint32 numStyles = reader.readUInt32();
+  quint32 numPages = reader.readUInt32();
+  if (!reader.ok() || version != binaryMOJVersion)
+  {
+    return false;
+  }
+  if (docVersion > DOC_VERSION)
+  {
+    qWarning() << "binary MOJ has the newer document version" << docVersion << "- content of that version is dropped";
+  }
+
+  QVector<float> pattern;
+  for (quint32 i = 0; i < numStyles && reader.ok(); ++i)
+  {
+    QColor color = QColor::fromRgba(reader.readUInt32());
+    reader.readFloats(pattern, reader.readUInt32());
+    QVector<qreal> dashes;
+    for (float dash : pattern)
+    {
+      dashes.append(dash);
+    }
+    styles.append(StyleTable::instance().intern(color, dashes));
+  }
+
+  for (quint32 i = 0; i < numPages && reader.ok(); ++i)
+  {
+    quint32 offset = reader.readUInt32();
+    quint32 size = reader.readUInt32();
+    if (offset < binaryMOJHeaderSize || offset > static_cast<quint32>(data.size()) || size > static_cast<quint32>(data.size()) - offset)
+    {
+      return false;
+    }
+    PageJob job;
+    job.offset = offset;
+    job.data = QByteArray::fromRawData(data.constData() + offset, size);
+    job.ok = false;
+    jobs.append(job);
+  }
+  return reader.ok();
+}
+
+/**
+ * @brief Document::splitMappedMOJ sets up the pages of a mapped binary MOJ for lazy loading. Only the page table and the size and background of
+ * the pages are read, so this takes the same time for any size of document. The strokes of a page are decoded by its PageLoader.
+ * @param file
+ * @param jobs gets one job per page, with a page that isn't loaded yet
+ * @param styles gets the index into the StyleTable of every style of the file
+ * @return false if the file is damaged or from a newer version
+ */
+bool Document::splitMappedMOJ(const QSharedPointer<MappedFile> &file, QVector<PageJob> &jobs, QVector<int> &styles)
+{
+  if (!splitBinaryMOJ(file->data(), jobs, styles))
+  {
+    return false;
+  }
+
+  QSharedPointer<const QVector<int>> sharedStyles(new QVector<int>(styles));
+  for (PageJob &job : jobs)
+  {
+    BinaryReader reader(job.data);
+    job.page.setWidth(reader.readFloat());
+    job.page.setHeight(reader.readFloat());
+    job.page.setBackgroundColor(QColor::fromRgba(reader.readUInt32()));
+    QSharedPointer<PageLoader> loader(new PageLoader(file, job.offset, job.data.size(), sharedStyles));
+    job.page.setLoader(loader);
+    m_pageLoaders.append(loader);
+    job.ok = reader.ok();
+  }
+  return true;
+}
+
+/**
+ * @brief Document::loadBinaryMOJPage decodes the chunk of a page of a binary MOJ.
+ * @param data
+ * @param page
+ * @param styles maps the styles of the file to the StyleTable
+ * @return false if the chunk is damaged
+ */
+bool Document::loadBinaryMOJPage(const QByteArray &data, Page &page, const QVector<int> &styles)
+{
+  BinaryReader reader(data);
+  page.setWidth(reader.readFloat());
+  page.setHeight(reader.readFloat());
+  page.setBackgroundColor(QColor::fromRgba(reader.readUInt32()));
+  quint32 numStrokes = reader.readUInt32();
+  // every point takes 12 bytes of the chunk
+  page.reserve((data.size() - 16) / 12);
+
+  // reused for all strokes, so reading a stroke doesn't allocate
+  QVector<float> xs;
+  QVector<float> ys;
+  QVector<float> pressures;
+  for (quint32 i = 0; i < numStrokes && reader.ok(); ++i)
+  {
+    quint32 style = reader.readUInt32();
+    qreal penWidth = reader.readFloat();
+    quint32 numPoints = reader.readUInt32();
+    reader.readFloats(xs, numPoints);
+    reader.readFloats(ys, numPoints);
+    reader.readFloats(pressures, numPoints);
+    if (!reader.ok() || style >= static_cast<quint32>(styles.size()))
+    {
+      return false;
+    }
+    page.appendStroke(xs.constData(), ys.constData(), pressures.constData(), numPoints, styles.at(style), penWidth);
+  }
+
+  page.clearDirtyRect();
+  return reader.ok();
+}
+
+/**
+ * @brief Document::saveLineBasedMOJ saves the document in the line based MOJ format, a plain text format that works well with version control.
+ * @details See documentation/line-based-file-format.adoc. The file starts with a header line, followed by a line per page, each followed by a
+ * line per stroke:
+ *
+ *     MrDoc; doc-version:0; app-version:0.0.3
+ *     Page; width:595; height:842; style:solid; color:#ffffffff
+ *     Stroke; #000000ff; solid; 1.41; points: 10.1 12.2 15.7 16.2 ; pressure: 0.9 0.85
+ *
+ * The pages are written in parallel. Numbers are written with nine significant digits, enough to read every float back exactly, so the format
+ * loses nothing, the strokes that didn't change since the file was loaded give the same lines again and a diff of two versions only shows the
+ * strokes that did.
+ * @param fileName
+ * @return
+ */
+bool Document::saveLineBasedMOJ(QString fileName)
+{
+  // the file might be the one lazily loaded pages are read from
+  loadAllPages();
+
+  // written to a temporary file that replaces the old one in commit(), so a failed save leaves the old file intact
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+
+  QVector<QByteArray> chunks = QtConcurrent::blockingMapped<QVector<QByteArray>>(pages, lineBasedMOJPage);
+
+  QByteArray header(lineBasedMOJMagic);
+  header.append(" doc-version:").append(QByteArray::number(DOC_VERSION));
+  header.append("; app-version:").append(QByteArray::number(MAJOR_VERSION)).append('.').append(QByteArray::number(MINOR_VERSION));
+  header.append('.').append(QByteArray::number(PATCH_VERSION)).append('\n');
+
+  bool success = file.write(header) == header.size();
+  for (const QByteArray &chunk : chunks)
+  {
+    success = success && file.write(chunk) == chunk.size();
+  }
+
+  QFileInfo fileInfo(fileName);
+
+  if (!success || !file.commit())
+  {
+    return false;
+  }
+  setDocumentChanged(false);
+  m_binaryLayout = BinaryLayout();
+  m_path = fileInfo.absolutePath();
+  m_docName = fileInfo.completeBaseName();
+  return true;
+}
+
+/**
+ * @brief Document::splitLineBasedMOJ reads the header line of a line based MOJ and finds the lines of every page.
+ * @param data
+ * @param jobs gets one job per page, whose data refers to the page line and the stroke lines that follow it in data
+ * @return false if the header is missing
+ */
+bool Document::splitLineBasedMOJ(const QByteArray &data, QVector<PageJob> &jobs)
+{
+  const char *it = data.constData();
+  const char *headerEnd = static_cast<const char *>(std::memchr(it, '\n', data.size()));
+  if (!data.startsWith(lineBasedMOJMagic) || headerEnd == nullptr)
+  {
+    return false;
+  }
+  const char *fieldBegin;
+  const char *fieldEnd;
+  while (nextField(it, headerEnd, fieldBegin, fieldEnd))
+  {
+    if (takeKey(fieldBegin, fieldEnd, "doc-version") && NumberParser::parseNumber(fieldBegin, fieldEnd) > DOC_VERSION)
+    {
+      qWarning() << "line based MOJ has the newer document version" << QByteArray(fieldBegin, fieldEnd - fieldBegin)
+                 << "- content of that version is dropped";
+    }
+  }
+
+  int start = data.indexOf("\nPage;");
+  while (start != -1)
+  {
+    ++start; // behind the line break
+    int next = data.indexOf("\nPage;", start);
+    int end = (next == -1) ? data.size() : next + 1;
+
+    PageJob job;
+    job.offset = start;
+    job.data = QByteArray::fromRawData(data.constData() + start, end - start);
+    job.ok = false;
+    jobs.append(job);
+    start = next;
+  }
+  return true;
+}
+
+/**
+ * @brief Document::loadLineBasedMOJPage decodes the lines of a single page of a line based MOJ. Lines of other kinds, like text, are skipped.
+ * @param data the page line and the stroke lines behind it
+ * @param page
+ * @return false if a stroke line is damaged
+ */
+bool Document::loadLineBasedMOJPage(const QByteArray &data, Page &page)
+{
+  // reused for all strokes, so parsing a stroke doesn't allocate
+  QVector<float> coordinates;
+  QVector<float> xs;
+  QVector<float> ys;
+  QVector<float> pressures;
+
+  const char *it = data.constData();
+  const char *end = it + data.size();
+  while (it != end)
+  {
+    const char *lineEnd = static_cast<const char *>(std::memchr(it, '\n', end - it));
+    if (lineEnd == nullptr)
+    {
+      lineEnd = end;
+    }
+    const char *field = it;
+    it = (lineEnd == end) ? end : lineEnd + 1;
+
+    const char *fieldBegin;
+    const char *fieldEnd;
+    if (!nextField(field, lineEnd, fieldBegin, fieldEnd))
+    {
+      continue; // an empty line
+    }
+    if (isWord(fieldBegin, fieldEnd, "Page"))
+    {
+      while (nextField(field, lineEnd, fieldBegin, fieldEnd))
+      {
+        if (takeKey(fieldBegin, fieldEnd, "width"))
+        {
+          page.setWidth(NumberParser::parseNumber(fieldBegin, fieldEnd));
+        }
+        else if (takeKey(fieldBegin, fieldEnd, "height"))
+        {
+          page.setHeight(NumberParser::parseNumber(fieldBegin, fieldEnd));
+        }
+        else if (takeKey(fieldBegin, fieldEnd, "color"))
+        {
+          QColor color;
+          if (parseColor(fieldBegin, fieldEnd, color))
+          {
+            page.setBackgroundColor(color);
+          }
+        }
+      }
+    }
+    else if (isWord(fieldBegin, fieldEnd, "Stroke"))
+    {
+      QColor color;
+      if (!nextField(field, lineEnd, fieldBegin, fieldEnd) || !parseColor(fieldBegin, fieldEnd, color))
+      {
+        return false;
+      }
+      if (!nextField(field, lineEnd, fieldBegin, fieldEnd))
+      {
+        return false;
+      }
+      int style = StyleTable::instance().intern(color, patternFromName(fieldBegin, fieldEnd));
+      if (!nextField(field, lineEnd, fieldBegin, fieldEnd))
+      {
+        return false;
+      }
+      qreal penWidth = NumberParser::parseNumber(fieldBegin, fieldEnd);
+      if (!nextField(field, lineEnd, fieldBegin, fieldEnd) || !takeKey(fieldBegin, fieldEnd, "points"))
+      {
+        return false;
+      }
+      coordinates.clear();
+      NumberParser::parse(fieldBegin, fieldEnd, coordinates);
+      if (!nextField(field, lineEnd, fieldBegin, fieldEnd) || !takeKey(fieldBegin, fieldEnd, "pressure"))
+      {
+        return false;
+      }
+      pressures.clear();
+      NumberParser::parse(fieldBegin, fieldEnd, pressures);
+      splitCoordinates(coordinates, xs, ys);
+      if (coordinates.size() % 2 != 0 || pressures.size() != xs.size())
+      {
+        return false;
+      }
+      if (!xs.isEmpty())
+      {
+        page.appendStroke(xs.constData(), ys.constData(), pressures.constData(), xs.size(), style, penWidth);
+      }
+    }
+  }
+
+  page.clearDirtyRect();
+  return true;
+}
+
+/**
+ * @brief Document::loadAllPages decodes all pages that are still loaded lazily, in parallel. This includes pages that were removed from the
+ * document but are still kept by the undo stack, so the mapped file is released, which can't be replaced while it is mapped on Windows.
+ */
+void Document::loadAllPages()
+{
+  QtConcurrent::blockingMap(pages, [](Page &page) { page.load(); });
+
+  QVector<QSharedPointer<PageLoader>> loaders;
+  for (const QWeakPointer<PageLoader> &loader : m_pageLoaders)
+  {
+    QSharedPointer<PageLoader> strongLoader = loader.toStrongRef();
+    if (strongLoader)
+    {
+      loaders.append(strongLoader);
+    }
+  }
+  QtConcurrent::blockingMap(loaders, [](QSharedPointer<PageLoader> &loader) { loader->page(); });
+  m_pageLoaders.clear();
+}
+
 bool Document::setDocName(QString docName)
 {
   // check for special characters not to be used in filenames ... (probably
@@ -616,9 +1793,56 @@ bool Document::documentChanged()
   return m_documentChanged;
 }
 
+/**
+ * @brief Document::revision
+ * @return a number that changes whenever the document is marked as changed
+ */
+quint64 Document::revision() const
+{
+  return m_revision;
+}
+
 void Document::setDocumentChanged(bool changed)
 {
   m_documentChanged = changed;
+  if (changed)
+  {
+    ++m_revision;
+  }
+}
+
+/**
+ * @brief Document::takeBinaryLayout takes over where the pages are in the binary MOJ a copy of the document was saved to, so the next
+ * updateBinaryMOJ() only writes the pages that changed since the copy was made.
+ * @param savedDocument
+ */
+void Document::takeBinaryLayout(const Document &savedDocument)
+{
+  m_binaryLayout = savedDocument.m_binaryLayout;
+}
+
+/**
+ * @brief Document::setBinaryLayout remembers the chunk of every page in a binary MOJ that was just loaded or written.
+ * @param fileName
+ * @param styles index into the StyleTable of every style in the file
+ * @param pageTable offset and size of the chunk of every page
+ * @param newFile forget the chunks of earlier versions of the file, which are gone
+ */
+void Document::setBinaryLayout(const QString &fileName, const QVector<int> &styles, const PageTable &pageTable, bool newFile)
+{
+  if (newFile)
+  {
+    m_binaryLayout.chunks.clear();
+  }
+  QFileInfo fileInfo(fileName);
+  m_binaryLayout.fileName = fileInfo.absoluteFilePath();
+  m_binaryLayout.fileSize = fileInfo.size();
+  m_binaryLayout.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+  m_binaryLayout.styles = styles;
+  for (int i = 0; i < pages.size() && i < pageTable.size(); ++i)
+  {
+    m_binaryLayout.chunks.insert(pages[i].generation(), pageTable[i]);
+  }
 }
 
 QString Document::toARGB(QString rgba)
@@ -3,11 +3,22 @@
 
 #include "page.h"
 
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
 #include <QVector>
+#include <QWeakPointer>
+
+#include <functional>
+
+class QIODevice;
 
 namespace MrDoc
 {
 
+class MappedFile;
+class PageLoader;
+
 class Document
 {
 public:
@@ -21,6 +32,9 @@ public:
 
   bool loadMOJ(QString fileName);
   bool saveMOJ(QString fileName);
+  bool saveBinaryMOJ(QString fileName);
+  bool updateBinaryMOJ(QString fileName);
+  bool saveLineBasedMOJ(QString fileName);
 
   void paintPage(int pageNum, QPainter &painter, qreal zoom);
 
@@ -32,19 +46,63 @@ public:
 
   bool documentChanged();
   void setDocumentChanged(bool changed);
+  quint64 revision() const;
+
+  void takeBinaryLayout(const Document &savedDocument);
 
   QVector<MrDoc::Page> pages;
 
+  static bool loadBinaryMOJPage(const QByteArray &data, Page &page, const QVector<int> &styles);
+
   QString toRGBA(QString argb);
   QString toARGB(QString rgba);
 
   QColor stringToColor(QString colorString);
 
 private:
+  struct PageJob
+  {
+    int offset;      // of the page element in the document
+    QByteArray data; // the page element, usually refers to the data of the whole document
+    Page page;
+    bool ok;
+  };
+
+  static bool streamPages(QIODevice &device, QByteArray &data, QVector<PageJob> &jobs, const std::function<bool(const QByteArray &, Page &)> &loadPage);
+  bool collectPages(const QVector<PageJob> &jobs);
+  bool loadXOJPage(const QByteArray &data, Page &page);
+  bool loadMOJPage(const QByteArray &data, Page &page);
+
+  typedef QVector<QPair<quint32, quint32>> PageTable; // offset and size of the chunk of every page in a binary MOJ
+
+  /**
+   * @brief The BinaryLayout struct tells where the pages are in the binary MOJ the document was last loaded from or saved to, so that
+   * updateBinaryMOJ() only has to write the pages that changed since.
+   */
+  struct BinaryLayout
+  {
+    QString fileName;        // absolute, empty unless the document is in a binary MOJ
+    qint64 fileSize = 0;     // the file is only updated if it wasn't changed by anyone else since
+    qint64 lastModified = 0; // in ms since the epoch
+    QVector<int> styles;     // index into the StyleTable of every style in the file
+    QHash<quint64, QPair<quint32, quint32>> chunks; // the chunk in the file of every page generation()
+  };
+
+  static bool splitBinaryMOJ(const QByteArray &data, QVector<PageJob> &jobs, QVector<int> &styles);
+  bool splitMappedMOJ(const QSharedPointer<MappedFile> &file, QVector<PageJob> &jobs, QVector<int> &styles);
+  void setBinaryLayout(const QString &fileName, const QVector<int> &styles, const PageTable &pageTable, bool newFile);
+  static bool splitLineBasedMOJ(const QByteArray &data, QVector<PageJob> &jobs);
+  static bool loadLineBasedMOJPage(const QByteArray &data, Page &page);
+  void loadAllPages();
+
   bool m_documentChanged;
+  quint64 m_revision = 0;
 
   QString m_docName;
   QString m_path;
+
+  BinaryLayout m_binaryLayout;
+  QVector<QWeakPointer<PageLoader>> m_pageLoaders; // of every page loaded lazily, also of those only the undo stack still has
 };
 }
 
@@ -0,0 +1,276 @@
+#include "eraser.h"
+
+#include <algorithm>
+
+namespace MrDoc
+{
+
+Eraser::Eraser(qreal size) : m_size(size)
+{
+}
+
+void Eraser::setSize(qreal size)
+{
+  m_size = size;
+}
+
+qreal Eraser::size() const
+{
+  return m_size;
+}
+
+/**
+ * @brief Eraser::erase sweeps the eraser from one position to another.
+ * @param page
+ * @param from
+ * @param to
+ * @param split cut the erased parts out of the strokes instead of deleting the strokes that are hit
+ * @return the strokes that are hit, sorted by their number
+ */
+QVector<Eraser::Hit> Eraser::erase(const Page &page, const QPointF &from, const QPointF &to, bool split) const
+{
+  QRectF shapeRect;
+  QVector<Edge> shape = sweptShape(from, to, shapeRect);
+
+  QVector<Hit> hits;
+  QVector<char> candidates;
+  const QVector<Stroke> &strokes = page.strokes();
+  for (int strokeNum : page.strokesIntersecting(shapeRect))
+  {
+    const Stroke &stroke = strokes.at(strokeNum);
+    const float *x = stroke.xData();
+    const float *y = stroke.yData();
+    const float *pressures = stroke.pressureData();
+    int n = stroke.size();
+
+    if (n == 1)
+    {
+      if (contains(shape, stroke.point(0)))
+      {
+        hits.append({strokeNum, QVector<Stroke>()});
+      }
+      continue;
+    }
+
+    // cheap test of the bounding box of every segment first
+    candidates.resize(n - 1);
+    float left = shapeRect.left();
+    float right = shapeRect.right();
+    float top = shapeRect.top();
+    float bottom = shapeRect.bottom();
+    bool anyCandidate = false;
+    for (int j = 0; j < n - 1; ++j)
+    {
+      float minX = qMin(x[j], x[j + 1]);
+      float maxX = qMax(x[j], x[j + 1]);
+      float minY = qMin(y[j], y[j + 1]);
+      float maxY = qMax(y[j], y[j + 1]);
+      candidates[j] = maxX >= left && minX <= right && maxY >= top && minY <= bottom;
+      anyCandidate |= candidates[j];
+    }
+    if (!anyCandidate)
+    {
+      continue;
+    }
+
+    auto point = [x, y](int j)
+    {
+      return QPointF(x[j], y[j]);
+    };
+
+    if (!split)
+    {
+      for (int j = 0; j < n - 1; ++j)
+      {
+        qreal t0, t1;
+        if (candidates[j] && clip(shape, point(j), point(j + 1), t0, t1))
+        {
+          hits.append({strokeNum, QVector<Stroke>()});
+          break;
+        }
+      }
+      continue;
+    }
+
+    // collect the parts of the stroke outside of the shape
+    QVector<Stroke> pieces;
+    QVector<float> pieceXs;
+    QVector<float> pieceYs;
+    QVector<float> piecePressures;
+    bool cut = false;
+    auto appendToPiece = [&](const QPointF &p, qreal pressure)
+    {
+      pieceXs.append(p.x());
+      pieceYs.append(p.y());
+      piecePressures.append(pressure);
+    };
+    auto finishPiece = [&]()
+    {
+      if (pieceXs.size() > 1)
+      {
+        Stroke piece = stroke;
+        piece.setPoints(pieceXs, pieceYs, piecePressures);
+        pieces.append(piece);
+      }
+      pieceXs.clear();
+      pieceYs.clear();
+      piecePressures.clear();
+    };
+
+    appendToPiece(point(0), pressures[0]);
+    for (int j = 0; j < n - 1; ++j)
+    {
+      qreal t0, t1;
+      QPointF p0 = point(j);
+      QPointF p1 = point(j + 1);
+      // segments that only touch the shape are not cut
+      if (!candidates[j] || !clip(shape, p0, p1, t0, t1) || t1 - t0 < 1e-9)
+      {
+        if (pieceXs.isEmpty())
+        {
+          appendToPiece(p0, pressures[j]);
+        }
+        appendToPiece(p1, pressures[j + 1]);
+        continue;
+      }
+
+      cut = true;
+      if (t0 > 0.0)
+      {
+        if (pieceXs.isEmpty())
+        {
+          appendToPiece(p0, pressures[j]);
+        }
+        appendToPiece(p0 + t0 * (p1 - p0), pressures[j] + t0 * (pressures[j + 1] - pressures[j]));
+      }
+      finishPiece();
+      if (t1 < 1.0)
+      {
+        appendToPiece(p0 + t1 * (p1 - p0), pressures[j] + t1 * (pressures[j + 1] - pressures[j]));
+        appendToPiece(p1, pressures[j + 1]);
+      }
+    }
+    if (cut)
+    {
+      finishPiece();
+      hits.append({strokeNum, pieces});
+    }
+  }
+
+  return hits;
+}
+
+/**
+ * @brief Eraser::sweptShape computes the convex hull of the eraser square at both positions.
+ * @param from
+ * @param to
+ * @param boundingRect is set to the bounding rect of the shape
+ * @return the edges of the shape
+ */
+QVector<Eraser::Edge> Eraser::sweptShape(const QPointF &from, const QPointF &to, QRectF &boundingRect) const
+{
+  qreal h = m_size / 2.0;
+  QVector<QPointF> corners;
+  for (const QPointF &center : {from, to})
+  {
+    corners.append(center + QPointF(-h, -h));
+    corners.append(center + QPointF(h, -h));
+    corners.append(center + QPointF(h, h));
+    corners.append(center + QPointF(-h, h));
+  }
+
+  QPolygonF cornerPolygon(corners);
+  boundingRect = cornerPolygon.boundingRect();
+
+  // monotone chain
+  std::sort(corners.begin(), corners.end(), [](const QPointF &a, const QPointF &b)
+            {
+              return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+            });
+  auto cross = [](const QPointF &o, const QPointF &a, const QPointF &b)
+  {
+    return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+  };
+  QVector<QPointF> hull(2 * corners.size());
+  int k = 0;
+  for (int i = 0; i < corners.size(); ++i)
+  {
+    while (k >= 2 && cross(hull.at(k - 2), hull.at(k - 1), corners.at(i)) <= 0)
+    {
+      --k;
+    }
+    hull[k++] = corners.at(i);
+  }
+  for (int i = corners.size() - 2, lower = k + 1; i >= 0; --i)
+  {
+    while (k >= lower && cross(hull.at(k - 2), hull.at(k - 1), corners.at(i)) <= 0)
+    {
+      --k;
+    }
+    hull[k++] = corners.at(i);
+  }
+  hull.resize(k - 1);
+
+  // the hull only turns left, so the inside is to the left of every edge
+  QVector<Edge> edges;
+  for (int i = 0; i < hull.size(); ++i)
+  {
+    QPointF a = hull.at(i);
+    QPointF b = hull.at((i + 1) % hull.size());
+    edges.append({a, QPointF(-(b.y() - a.y()), b.x() - a.x())});
+  }
+  return edges;
+}
+
+/**
+ * @brief Eraser::clip clips the segment from p0 to p1 against a convex shape (Cyrus-Beck).
+ * @return false if the segment doesn't intersect the shape, otherwise t0 and t1 are the parameters of the part inside
+ */
+bool Eraser::clip(const QVector<Edge> &shape, const QPointF &p0, const QPointF &p1, qreal &t0, qreal &t1)
+{
+  t0 = 0.0;
+  t1 = 1.0;
+  QPointF d = p1 - p0;
+  for (const Edge &edge : shape)
+  {
+    qreal distance = QPointF::dotProduct(edge.normal, p0 - edge.point);
+    qreal rate = QPointF::dotProduct(edge.normal, d);
+    if (rate == 0.0)
+    {
+      if (distance < 0.0)
+      {
+        return false;
+      }
+    }
+    else
+    {
+      qreal t = -distance / rate;
+      if (rate > 0.0)
+      {
+        t0 = qMax(t0, t);
+      }
+      else
+      {
+        t1 = qMin(t1, t);
+      }
+      if (t0 > t1)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Eraser::contains(const QVector<Edge> &shape, const QPointF &point)
+{
+  for (const Edge &edge : shape)
+  {
+    if (QPointF::dotProduct(edge.normal, point - edge.point) < 0.0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+}
@@ -0,0 +1,47 @@
+#ifndef ERASER_H
+#define ERASER_H
+
+#include "page.h"
+
+namespace MrDoc
+{
+
+/**
+ * @brief The Eraser class finds everything the eraser hits on a page while it moves from one position to the next.
+ * @details The eraser is a square that is swept along the line between the two positions, so nothing is skipped if it is moved quickly. The
+ * strokes below the swept shape are looked up in the stroke grid of the page. Their segments are tested against the bounding box of the shape and the
+ * remaining ones are clipped against the shape itself. All hits are returned at once, either as strokes to delete or as the pieces that are left
+ * when the erased part is cut out.
+ */
+class Eraser
+{
+public:
+  struct Hit
+  {
+    int strokeNum;
+    QVector<Stroke> pieces; // what is left of the stroke, empty if it is erased entirely
+  };
+
+  explicit Eraser(qreal size = 10.0);
+
+  void setSize(qreal size);
+  qreal size() const;
+
+  QVector<Hit> erase(const Page &page, const QPointF &from, const QPointF &to, bool split) const;
+
+private:
+  struct Edge
+  {
+    QPointF point;
+    QPointF normal; // points inside
+  };
+
+  QVector<Edge> sweptShape(const QPointF &from, const QPointF &to, QRectF &boundingRect) const;
+  static bool clip(const QVector<Edge> &shape, const QPointF &p0, const QPointF &p1, qreal &t0, qreal &t1);
+  static bool contains(const QVector<Edge> &shape, const QPointF &point);
+
+  qreal m_size;
+};
+}
+
+#endif // ERASER_H
@@ -0,0 +1,30 @@
+#include "filesync.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace MrDoc
+{
+
+/**
+ * @brief syncFile writes what was written to a file through to the disk, not only to the system, which may reorder the writes and loses them
+ * if it crashes or the power fails.
+ * @param file
+ * @return true if the data is on the disk
+ */
+bool syncFile(QFileDevice &file)
+{
+  if (!file.flush())
+  {
+    return false;
+  }
+#ifdef Q_OS_WIN
+  return _commit(file.handle()) == 0;
+#else
+  return fsync(file.handle()) == 0;
+#endif
+}
+}
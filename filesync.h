@@ -0,0 +1,12 @@
+#ifndef FILESYNC_H
+#define FILESYNC_H
+
+#include <QFileDevice>
+
+namespace MrDoc
+{
+
+bool syncFile(QFileDevice &file);
+}
+
+#endif // FILESYNC_H
@@ -0,0 +1,275 @@
+#include "gzipdevice.h"
+
+#include <QtConcurrent>
+
+#include <cstring>
+#include <limits>
+
+constexpr int GzipDevice::chunkSize;
+constexpr int GzipDevice::blockSize;
+constexpr int GzipDevice::dictionarySize;
+
+/**
+ * @brief GzipDevice::GzipDevice
+ * @param device to read compressed data from or write it to
+ * @param level the compression level (@c 0 = no compression, @c 9 = max, @c -1 = default)
+ * @param parent
+ */
+GzipDevice::GzipDevice(QIODevice *device, int level, QObject *parent) : QIODevice(parent), m_device(device), m_level(level)
+{
+  std::memset(&m_stream, 0, sizeof(m_stream));
+}
+
+GzipDevice::~GzipDevice()
+{
+  if (isOpen())
+  {
+    close();
+  }
+}
+
+bool GzipDevice::open(OpenMode mode)
+{
+  bool reading = mode & ReadOnly;
+  bool writing = mode & WriteOnly;
+  if (reading == writing)
+  {
+    setErrorString("GzipDevice can only be opened for either reading or writing");
+    return false;
+  }
+
+  m_error = false;
+  if (reading)
+  {
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    // 16 added to the window bits selects the gzip format instead of raw zlib
+    if (inflateInit2(&m_stream, MAX_WBITS + 16) != Z_OK)
+    {
+      setErrorString("could not initialize zlib");
+      return false;
+    }
+    m_buffer.resize(chunkSize);
+    m_streamOpen = true;
+    m_streamEnd = false;
+  }
+  else
+  {
+    // gzip header: magic, deflate, no flags, no time, no extra flags, unknown OS
+    static const char header[] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+    if (m_device->write(header, sizeof(header)) != sizeof(header))
+    {
+      setErrorString(m_device->errorString());
+      return false;
+    }
+    m_crc = crc32(0, Z_NULL, 0);
+    m_size = 0;
+    m_block.clear();
+    m_block.reserve(blockSize);
+    m_dictionary.clear();
+  }
+
+  // the data is buffered by zlib and in m_buffer or m_block already
+  return QIODevice::open(mode | Unbuffered);
+}
+
+/**
+ * @brief GzipDevice::close writes the rest of the gzip stream when writing. Whether that worked is reported by hasError().
+ */
+void GzipDevice::close()
+{
+  if (openMode() & WriteOnly)
+  {
+    compressBlock(true);
+    while (!m_pendingBlocks.isEmpty())
+    {
+      writeBlock(m_pendingBlocks.dequeue().result());
+    }
+
+    // gzip trailer: checksum and size, little endian
+    char trailer[8];
+    for (int i = 0; i < 4; ++i)
+    {
+      trailer[i] = static_cast<char>((m_crc >> (8 * i)) & 0xff);
+      trailer[4 + i] = static_cast<char>((m_size >> (8 * i)) & 0xff);
+    }
+    if (!m_error && m_device->write(trailer, sizeof(trailer)) != sizeof(trailer))
+    {
+      setError(m_device->errorString());
+    }
+    m_block.clear();
+    m_dictionary.clear();
+  }
+  if (m_streamOpen)
+  {
+    inflateEnd(&m_stream);
+    m_streamOpen = false;
+  }
+  m_buffer.clear();
+  QIODevice::close();
+}
+
+bool GzipDevice::isSequential() const
+{
+  return true;
+}
+
+bool GzipDevice::atEnd() const
+{
+  return m_streamEnd && QIODevice::atEnd();
+}
+
+/**
+ * @brief GzipDevice::hasError
+ * @return true if the data could not be read or written, see errorString()
+ */
+bool GzipDevice::hasError() const
+{
+  return m_error;
+}
+
+/**
+ * @brief GzipDevice::readData decompresses data until maxSize bytes are there or the gzip stream ends.
+ * @param data
+ * @param maxSize
+ * @return the number of bytes read, or -1 if the compressed data is damaged or could not be read
+ */
+qint64 GzipDevice::readData(char *data, qint64 maxSize)
+{
+  if (m_error)
+  {
+    return -1;
+  }
+
+  uInt size = static_cast<uInt>(qMin(maxSize, static_cast<qint64>(std::numeric_limits<int>::max())));
+  m_stream.next_out = reinterpret_cast<Bytef *>(data);
+  m_stream.avail_out = size;
+  while (m_stream.avail_out > 0 && !m_streamEnd)
+  {
+    if (m_stream.avail_in == 0)
+    {
+      qint64 bytesRead = m_device->read(m_buffer.data(), chunkSize);
+      if (bytesRead <= 0)
+      {
+        setError(bytesRead < 0 ? m_device->errorString() : QString("unexpected end of gzip data"));
+        return -1;
+      }
+      m_stream.next_in = reinterpret_cast<Bytef *>(m_buffer.data());
+      m_stream.avail_in = static_cast<uInt>(bytesRead);
+    }
+
+    int ret = inflate(&m_stream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+      m_streamEnd = true;
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      setError(m_stream.msg ? QString(m_stream.msg) : QString("damaged gzip data"));
+      return -1;
+    }
+  }
+  return size - m_stream.avail_out;
+}
+
+/**
+ * @brief GzipDevice::writeData collects data into blocks and hands every full block to the thread pool.
+ * @param data
+ * @param maxSize
+ * @return maxSize, or -1 if the underlying device could not be written
+ */
+qint64 GzipDevice::writeData(const char *data, qint64 maxSize)
+{
+  qint64 written = 0;
+  while (written < maxSize && !m_error)
+  {
+    int size = static_cast<int>(qMin(maxSize - written, static_cast<qint64>(blockSize - m_block.size())));
+    m_block.append(data + written, size);
+    written += size;
+    if (m_block.size() == blockSize)
+    {
+      compressBlock(false);
+    }
+  }
+  return m_error ? -1 : written;
+}
+
+/**
+ * @brief GzipDevice::compressBlock starts compressing the current block. Once too many blocks are in flight, the oldest ones are waited for and
+ * written, in order.
+ * @param last
+ */
+void GzipDevice::compressBlock(bool last)
+{
+  m_crc = crc32(m_crc, reinterpret_cast<const Bytef *>(m_block.constData()), static_cast<uInt>(m_block.size()));
+  m_size += static_cast<quint32>(m_block.size());
+
+  m_pendingBlocks.enqueue(QtConcurrent::run(&GzipDevice::deflateBlock, m_block, m_dictionary, m_level, last));
+  m_dictionary = m_block.right(dictionarySize);
+  m_block = QByteArray();
+  m_block.reserve(blockSize);
+
+  int maxPendingBlocks = 2 * qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  while (m_pendingBlocks.size() > maxPendingBlocks)
+  {
+    writeBlock(m_pendingBlocks.dequeue().result());
+  }
+}
+
+void GzipDevice::writeBlock(const QByteArray &output)
+{
+  if (m_error)
+  {
+    return;
+  }
+  if (output.isEmpty())
+  {
+    setError("could not compress data");
+  }
+  else if (m_device->write(output) != output.size())
+  {
+    setError(m_device->errorString());
+  }
+}
+
+/**
+ * @brief GzipDevice::deflateBlock compresses a block as raw deflate data, so that it can be put into the gzip stream as it is. This runs on the
+ * thread pool.
+ * @param input
+ * @param dictionary the data that precedes the block
+ * @param level
+ * @param last ends the deflate stream if true, otherwise the output ends on a byte boundary with a sync flush
+ * @return the compressed block, empty on error
+ */
+QByteArray GzipDevice::deflateBlock(const QByteArray &input, const QByteArray &dictionary, int level, bool last)
+{
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  // negative window bits select raw deflate without header and trailer
+  if (deflateInit2(&stream, qBound(-1, level, 9), Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    return QByteArray();
+  }
+  if (!dictionary.isEmpty())
+  {
+    deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dictionary.constData()), static_cast<uInt>(dictionary.size()));
+  }
+
+  // deflateBound() doesn't include the few bytes of the sync flush
+  QByteArray output;
+  output.resize(static_cast<int>(deflateBound(&stream, static_cast<uLong>(input.size()))) + 16);
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.constData()));
+  stream.avail_in = static_cast<uInt>(input.size());
+  stream.next_out = reinterpret_cast<Bytef *>(output.data());
+  stream.avail_out = static_cast<uInt>(output.size());
+  int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  bool complete = last ? ret == Z_STREAM_END : ret == Z_OK && stream.avail_in == 0;
+  output.resize(static_cast<int>(stream.total_out));
+  deflateEnd(&stream);
+  return complete ? output : QByteArray();
+}
+
+void GzipDevice::setError(const QString &errorString)
+{
+  m_error = true;
+  setErrorString(errorString);
+}
@@ -0,0 +1,67 @@
+#ifndef GZIPDEVICE_H
+#define GZIPDEVICE_H
+
+#include <QFuture>
+#include <QIODevice>
+#include <QQueue>
+
+#include <zlib.h>
+
+/**
+ * @brief The GzipDevice class compresses everything written to it into another device, or decompresses the data it reads from another device,
+ * chunk by chunk in the gzip format.
+ * @details It is meant to sit between a file and QXmlStreamReader or QXmlStreamWriter, so a document never has to be held compressed and
+ * uncompressed in memory at the same time. The device is sequential and can only be opened either for reading or for writing. The underlying
+ * device has to be open and is not closed by close(), which finishes the gzip stream when writing.
+ *
+ * Writing compresses in parallel like pigz: the data is cut into blocks that are deflated independently on the global thread pool, each with the
+ * end of the previous block as dictionary so the ratio hardly suffers. Every block but the last ends with a sync flush, which ends it on a byte
+ * boundary, so the blocks simply follow each other in one ordinary gzip stream. The checksum is computed while writing. Only a few blocks per
+ * thread are in flight at any time, so memory stays bounded.
+ */
+class GzipDevice : public QIODevice
+{
+public:
+  static constexpr int chunkSize = 64 * 1024;   // of compressed data read at once
+  static constexpr int blockSize = 128 * 1024;  // of data compressed by one task
+  static constexpr int dictionarySize = 32 * 1024;
+
+  explicit GzipDevice(QIODevice *device, int level = -1, QObject *parent = nullptr);
+  ~GzipDevice();
+
+  bool open(OpenMode mode) override;
+  void close() override;
+  bool isSequential() const override;
+  bool atEnd() const override;
+
+  bool hasError() const;
+
+protected:
+  qint64 readData(char *data, qint64 maxSize) override;
+  qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+  static QByteArray deflateBlock(const QByteArray &input, const QByteArray &dictionary, int level, bool last);
+  void compressBlock(bool last);
+  void writeBlock(const QByteArray &output);
+  void setError(const QString &errorString);
+
+  QIODevice *m_device;
+  int m_level;
+  bool m_error = false;
+
+  // reading
+  z_stream m_stream;
+  bool m_streamOpen = false;
+  bool m_streamEnd = false;
+  QByteArray m_buffer; // compressed data that was read
+
+  // writing
+  QByteArray m_block;      // data that waits for the block to fill up
+  QByteArray m_dictionary; // the end of the previous block
+  QQueue<QFuture<QByteArray>> m_pendingBlocks;
+  uLong m_crc = 0;
+  quint32 m_size = 0; // of the uncompressed data, modulo 2^32 like in the gzip trailer
+};
+
+#endif // GZIPDEVICE_H
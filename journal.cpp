@@ -0,0 +1,655 @@
+#include "journal.h"
+#include "document.h"
+#include "filesync.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QPair>
+#include <QSaveFile>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+namespace MrDoc
+{
+
+namespace
+{
+const quint32 journalMagic = 0x4a57524d; // "MRWJ" in little endian
+const quint32 journalVersion = 1;
+
+enum class Record : quint8
+{
+  StrokeIds, // ids of the strokes of a page in the order of the file, written when the journal is compacted
+  AddStroke,
+  RemoveStroke,
+  ChangePage,
+  InsertPage,
+  RemovePage
+};
+
+/**
+ * @brief The PageIds struct maps the stroke ids of the journal to the ids of the strokes of a page that is replayed.
+ */
+struct PageIds
+{
+  bool inFileOrder = true; // the ids that aren't mapped are the same as on the replayed page
+  QHash<StrokeId, StrokeId> ids;
+
+  StrokeId map(StrokeId id) const
+  {
+    return ids.value(id, inFileOrder ? id : 0);
+  }
+};
+
+void setUpStream(QDataStream &stream)
+{
+  stream.setVersion(QDataStream::Qt_5_0);
+}
+
+/**
+ * @brief header identifies the saved document by its size and time, which a journal has to match to be replayed.
+ */
+QByteArray header(const QString &documentFileName)
+{
+  QFileInfo fileInfo(documentFileName);
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+  setUpStream(stream);
+  stream << journalMagic << journalVersion << static_cast<qint64>(fileInfo.size()) << static_cast<qint64>(fileInfo.lastModified().toMSecsSinceEpoch());
+  return data;
+}
+
+quint32 checksum(const QByteArray &data)
+{
+  return static_cast<quint32>(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(data.constData()), static_cast<uInt>(data.size())));
+}
+
+/**
+ * @brief frame puts the records of one step in front of their size and checksum, so replay can tell whether the step was written completely.
+ */
+QByteArray frame(const QByteArray &records)
+{
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+  setUpStream(stream);
+  stream << static_cast<quint32>(records.size()) << checksum(records);
+  stream.writeRawData(records.constData(), records.size());
+  return data;
+}
+
+/**
+ * @brief writeStroke writes the style of the stroke and its point data. The point data is written as it is in memory, the journal only has to be
+ * read on the machine that wrote it.
+ */
+void writeStroke(QDataStream &stream, const Stroke &stroke)
+{
+  int n = stroke.size();
+  stream << stroke.color() << stroke.pattern() << static_cast<double>(stroke.penWidth()) << static_cast<qint32>(n);
+  int dataSize = n * static_cast<int>(sizeof(float));
+  stream.writeRawData(reinterpret_cast<const char *>(stroke.xData()), dataSize);
+  stream.writeRawData(reinterpret_cast<const char *>(stroke.yData()), dataSize);
+  stream.writeRawData(reinterpret_cast<const char *>(stroke.pressureData()), dataSize);
+}
+
+bool readStroke(QDataStream &stream, Stroke &stroke)
+{
+  QColor color;
+  QVector<qreal> pattern;
+  double penWidth;
+  qint32 n;
+  stream >> color >> pattern >> penWidth >> n;
+  if (stream.status() != QDataStream::Ok || n <= 0 || n > stream.device()->bytesAvailable() / (3 * static_cast<qint64>(sizeof(float))))
+  {
+    return false;
+  }
+
+  int dataSize = n * static_cast<int>(sizeof(float));
+  QVector<float> xs(n);
+  QVector<float> ys(n);
+  QVector<float> pressures(n);
+  if (stream.readRawData(reinterpret_cast<char *>(xs.data()), dataSize) != dataSize ||
+      stream.readRawData(reinterpret_cast<char *>(ys.data()), dataSize) != dataSize ||
+      stream.readRawData(reinterpret_cast<char *>(pressures.data()), dataSize) != dataSize)
+  {
+    return false;
+  }
+  stroke.setColor(color);
+  stroke.setPattern(pattern);
+  stroke.setPenWidth(penWidth);
+  stroke.setPoints(xs, ys, pressures);
+  return true;
+}
+
+/**
+ * @brief replayRecords applies the records of one step to the document.
+ * @param records
+ * @param document
+ * @param pageIds one for every page of the document
+ * @return the number of changes, or -1 if the records are damaged
+ */
+int replayRecords(const QByteArray &records, Document &document, QVector<PageIds> &pageIds)
+{
+  QDataStream stream(records);
+  setUpStream(stream);
+  int numChanges = 0;
+  while (!stream.atEnd())
+  {
+    quint8 type;
+    qint32 pageNum;
+    stream >> type >> pageNum;
+    int numPages = document.pages.size();
+    int maxPageNum = (type == static_cast<quint8>(Record::InsertPage)) ? numPages : numPages - 1;
+    if (stream.status() != QDataStream::Ok || pageNum < 0 || pageNum > maxPageNum)
+    {
+      return -1;
+    }
+
+    switch (static_cast<Record>(type))
+    {
+    case Record::StrokeIds:
+    {
+      QVector<StrokeId> ids;
+      stream >> ids;
+      PageIds &page = pageIds[pageNum];
+      page.inFileOrder = false;
+      page.ids.clear();
+      for (int i = 0; i < ids.size(); ++i)
+      {
+        page.ids.insert(ids.at(i), static_cast<StrokeId>(i + 1));
+      }
+      break;
+    }
+    case Record::AddStroke:
+    {
+      StrokeId id;
+      StrokeId previousId;
+      Stroke stroke;
+      stream >> id >> previousId;
+      if (!readStroke(stream, stroke))
+      {
+        return -1;
+      }
+      Page &page = document.pages[pageNum];
+      StrokeId newId = (previousId == 0) ? page.prependStroke(stroke) : page.insertStrokeAfter(pageIds.at(pageNum).map(previousId), stroke);
+      pageIds[pageNum].ids.insert(id, newId);
+      ++numChanges;
+      break;
+    }
+    case Record::RemoveStroke:
+    {
+      StrokeId id;
+      stream >> id;
+      document.pages[pageNum].removeStroke(pageIds.at(pageNum).map(id));
+      ++numChanges;
+      break;
+    }
+    case Record::ChangePage:
+    {
+      double width;
+      double height;
+      QColor backgroundColor;
+      stream >> width >> height >> backgroundColor;
+      document.pages[pageNum].setWidth(width);
+      document.pages[pageNum].setHeight(height);
+      document.pages[pageNum].setBackgroundColor(backgroundColor);
+      ++numChanges;
+      break;
+    }
+    case Record::InsertPage:
+    {
+      double width;
+      double height;
+      QColor backgroundColor;
+      qint32 numStrokes;
+      stream >> width >> height >> backgroundColor >> numStrokes;
+      if (stream.status() != QDataStream::Ok || numStrokes < 0)
+      {
+        return -1;
+      }
+      Page page;
+      page.setWidth(width);
+      page.setHeight(height);
+      page.setBackgroundColor(backgroundColor);
+      PageIds ids;
+      ids.inFileOrder = false;
+      for (qint32 i = 0; i < numStrokes; ++i)
+      {
+        StrokeId id;
+        Stroke stroke;
+        stream >> id;
+        if (!readStroke(stream, stroke))
+        {
+          return -1;
+        }
+        ids.ids.insert(id, page.appendStroke(stroke));
+      }
+      document.pages.insert(pageNum, page);
+      pageIds.insert(pageNum, ids);
+      ++numChanges;
+      break;
+    }
+    case Record::RemovePage:
+    {
+      document.pages.removeAt(pageNum);
+      pageIds.removeAt(pageNum);
+      ++numChanges;
+      break;
+    }
+    default:
+      return -1;
+    }
+
+    if (stream.status() != QDataStream::Ok)
+    {
+      return -1;
+    }
+  }
+  return numChanges;
+}
+}
+
+Journal::Journal()
+{
+}
+
+/**
+ * @brief Journal::fileName
+ * @param documentFileName
+ * @return the name of the hidden journal file beside the document
+ */
+QString Journal::fileName(const QString &documentFileName)
+{
+  QFileInfo fileInfo(documentFileName);
+  return fileInfo.absolutePath() + "/." + fileInfo.fileName() + ".journal";
+}
+
+/**
+ * @brief Journal::replay applies the changes in the journal of a document to it. A step that wasn't written completely and everything behind it
+ * is left out.
+ * @param documentFileName
+ * @param document as loaded from documentFileName
+ * @return the number of steps that changed the document, 0 if there is no journal or it belongs to another version of the document
+ */
+int Journal::replay(const QString &documentFileName, Document &document)
+{
+  QFile file(fileName(documentFileName));
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    return 0;
+  }
+  QByteArray data = file.readAll();
+  QByteArray expectedHeader = header(documentFileName);
+  if (!data.startsWith(expectedHeader))
+  {
+    return 0;
+  }
+
+  QDataStream stream(data);
+  setUpStream(stream);
+  stream.skipRawData(expectedHeader.size());
+  QVector<PageIds> pageIds(document.pages.size());
+  int numSteps = 0;
+  while (!stream.atEnd())
+  {
+    quint32 size;
+    quint32 expectedChecksum;
+    stream >> size >> expectedChecksum;
+    if (stream.status() != QDataStream::Ok || size > stream.device()->bytesAvailable())
+    {
+      break;
+    }
+    QByteArray records(static_cast<int>(size), Qt::Uninitialized);
+    stream.readRawData(records.data(), records.size());
+    if (checksum(records) != expectedChecksum)
+    {
+      break;
+    }
+    int numChanges = replayRecords(records, document, pageIds);
+    if (numChanges < 0)
+    {
+      qWarning() << "damaged journal" << file.fileName();
+      break;
+    }
+    numSteps += (numChanges > 0);
+  }
+  return numSteps;
+}
+
+/**
+ * @brief Journal::start starts an empty journal for a document that was just loaded, replacing its old journal.
+ * @param documentFileName
+ * @return true if the journal could be written
+ */
+bool Journal::start(const QString &documentFileName)
+{
+  discard();
+  m_file.setFileName(fileName(documentFileName));
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    qWarning() << "could not write journal" << m_file.fileName() << m_file.errorString();
+    return false;
+  }
+  QByteArray fileHeader = header(documentFileName);
+  if (m_file.write(fileHeader) != fileHeader.size() || !syncFile(m_file))
+  {
+    m_file.close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Journal::discard stops journaling and deletes the journal, once the document is closed.
+ */
+void Journal::discard()
+{
+  if (m_file.isOpen())
+  {
+    m_file.close();
+    m_file.remove();
+  }
+  m_records.clear();
+  abortCompaction();
+}
+
+bool Journal::isActive() const
+{
+  return m_file.isOpen();
+}
+
+/**
+ * @brief Journal::size
+ * @return the size of the journal file in bytes
+ */
+qint64 Journal::size() const
+{
+  return m_file.isOpen() ? m_file.size() : 0;
+}
+
+bool Journal::isRecording() const
+{
+  return m_file.isOpen() || m_compacting;
+}
+
+/**
+ * @brief Journal::strokeAdded records a stroke that was added to a page or restored, along with the stroke it is painted after.
+ * @param pageNum
+ * @param page
+ * @param id
+ */
+void Journal::strokeAdded(int pageNum, const Page &page, StrokeId id)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  int strokeNum = page.strokeNum(id);
+  if (strokeNum == -1)
+  {
+    return;
+  }
+  StrokeId previousId = 0;
+  for (int i = strokeNum - 1; i >= 0; --i)
+  {
+    if (!page.strokes().at(i).isEmpty())
+    {
+      previousId = page.strokeId(i);
+      break;
+    }
+  }
+
+  QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+  setUpStream(stream);
+  stream << static_cast<quint8>(Record::AddStroke) << static_cast<qint32>(pageNum) << id << previousId;
+  writeStroke(stream, page.strokes().at(strokeNum));
+}
+
+/**
+ * @brief Journal::strokesAdded records strokes that were added together. They are recorded front to back, so the stroke each of them is painted
+ * after is already known when it is replayed.
+ * @param pageNum
+ * @param page
+ * @param ids
+ */
+void Journal::strokesAdded(int pageNum, const Page &page, const QVector<StrokeId> &ids)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  QVector<QPair<int, StrokeId>> strokeNumsAndIds;
+  strokeNumsAndIds.reserve(ids.size());
+  for (StrokeId id : ids)
+  {
+    strokeNumsAndIds.append(QPair<int, StrokeId>(page.strokeNum(id), id));
+  }
+  std::sort(strokeNumsAndIds.begin(), strokeNumsAndIds.end());
+  for (const auto &strokeNumAndId : strokeNumsAndIds)
+  {
+    strokeAdded(pageNum, page, strokeNumAndId.second);
+  }
+}
+
+/**
+ * @brief Journal::strokesRestored records strokes that are back in their place on a page, but aren't on the page itself, like the strokes of a
+ * selection whose release is undone. They are put back on a copy of the page to find the strokes they are painted after.
+ * @param pageNum
+ * @param page
+ * @param strokesAndIds
+ */
+void Journal::strokesRestored(int pageNum, const Page &page, const QVector<QPair<Stroke, StrokeId>> &strokesAndIds)
+{
+  if (!isRecording() || strokesAndIds.isEmpty())
+  {
+    return;
+  }
+  Page restoredPage = page;
+  restoredPage.restoreStrokes(strokesAndIds);
+  QVector<StrokeId> ids;
+  ids.reserve(strokesAndIds.size());
+  for (const auto &sAndId : strokesAndIds)
+  {
+    ids.append(sAndId.second);
+  }
+  strokesAdded(pageNum, restoredPage, ids);
+}
+
+void Journal::strokeRemoved(int pageNum, StrokeId id)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+  setUpStream(stream);
+  stream << static_cast<quint8>(Record::RemoveStroke) << static_cast<qint32>(pageNum) << id;
+}
+
+void Journal::strokesRemoved(int pageNum, const QVector<StrokeId> &ids)
+{
+  for (StrokeId id : ids)
+  {
+    strokeRemoved(pageNum, id);
+  }
+}
+
+/**
+ * @brief Journal::pageChanged records the size and background color of a page.
+ * @param pageNum
+ * @param page
+ */
+void Journal::pageChanged(int pageNum, const Page &page)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+  setUpStream(stream);
+  stream << static_cast<quint8>(Record::ChangePage) << static_cast<qint32>(pageNum) << static_cast<double>(page.width())
+         << static_cast<double>(page.height()) << page.backgroundColor();
+}
+
+/**
+ * @brief Journal::pageInserted records a page that was inserted, with all its strokes.
+ * @param pageNum
+ * @param page
+ */
+void Journal::pageInserted(int pageNum, const Page &page)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  qint32 numStrokes = 0;
+  for (const Stroke &stroke : page.strokes())
+  {
+    numStrokes += !stroke.isEmpty();
+  }
+
+  QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+  setUpStream(stream);
+  stream << static_cast<quint8>(Record::InsertPage) << static_cast<qint32>(pageNum) << static_cast<double>(page.width())
+         << static_cast<double>(page.height()) << page.backgroundColor() << numStrokes;
+  for (int i = 0; i < page.strokes().size(); ++i)
+  {
+    if (!page.strokes().at(i).isEmpty())
+    {
+      stream << page.strokeId(i);
+      writeStroke(stream, page.strokes().at(i));
+    }
+  }
+}
+
+void Journal::pageRemoved(int pageNum)
+{
+  if (!isRecording())
+  {
+    return;
+  }
+  QDataStream stream(&m_records, QIODevice::WriteOnly | QIODevice::Append);
+  setUpStream(stream);
+  stream << static_cast<quint8>(Record::RemovePage) << static_cast<qint32>(pageNum);
+}
+
+/**
+ * @brief Journal::flush writes the records of the last step of the undo stack as one frame and syncs it to the disk. If the journal can't be
+ * written, journaling stops.
+ * @return true if the records were written
+ */
+bool Journal::flush()
+{
+  if (m_records.isEmpty())
+  {
+    return true;
+  }
+  QByteArray recordsFrame = frame(m_records);
+  m_records.clear();
+  if (m_compacting)
+  {
+    m_compacted.append(recordsFrame);
+  }
+  if (!m_file.isOpen())
+  {
+    return true;
+  }
+  if (m_file.write(recordsFrame) != recordsFrame.size() || !syncFile(m_file))
+  {
+    qWarning() << "could not write journal" << m_file.fileName() << m_file.errorString();
+    m_file.close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Journal::beginCompaction is called when a snapshot of the document is taken to be saved. It records the ids of every page whose ids
+ * won't follow the order of the strokes in the saved file. Pages that were never loaded and pages whose strokes were only appended don't need
+ * this.
+ * @param document
+ */
+void Journal::beginCompaction(const Document &document)
+{
+  flush();
+  m_compacting = true;
+  m_compacted.clear();
+
+  QByteArray records;
+  QDataStream stream(&records, QIODevice::WriteOnly);
+  setUpStream(stream);
+  for (int pageNum = 0; pageNum < document.pages.size(); ++pageNum)
+  {
+    const Page &page = document.pages.at(pageNum);
+    if (!page.isLoaded())
+    {
+      continue;
+    }
+    QVector<StrokeId> ids;
+    bool inFileOrder = true;
+    for (int i = 0; i < page.strokes().size(); ++i)
+    {
+      if (!page.strokes().at(i).isEmpty())
+      {
+        ids.append(page.strokeId(i));
+        inFileOrder = inFileOrder && ids.last() == static_cast<StrokeId>(ids.size());
+      }
+    }
+    if (!inFileOrder)
+    {
+      stream << static_cast<quint8>(Record::StrokeIds) << static_cast<qint32>(pageNum) << ids;
+    }
+  }
+  if (!records.isEmpty())
+  {
+    m_compacted = frame(records);
+  }
+}
+
+/**
+ * @brief Journal::finishCompaction replaces the journal by the one that was collected since beginCompaction(), once the document is saved.
+ * @param documentFileName the saved file, which may differ from the file of the old journal
+ * @return true if the new journal could be written
+ */
+bool Journal::finishCompaction(const QString &documentFileName)
+{
+  if (!m_compacting)
+  {
+    return false;
+  }
+  flush();
+  m_compacting = false;
+  QByteArray compacted = header(documentFileName) + m_compacted;
+  m_compacted.clear();
+
+  QSaveFile file(fileName(documentFileName));
+  if (!file.open(QIODevice::WriteOnly) || file.write(compacted) != compacted.size() || !syncFile(file) || !file.commit())
+  {
+    qWarning() << "could not write journal" << file.fileName() << file.errorString();
+    return false;
+  }
+
+  if (m_file.isOpen())
+  {
+    m_file.close();
+    if (m_file.fileName() != file.fileName())
+    {
+      m_file.remove();
+    }
+  }
+  m_file.setFileName(file.fileName());
+  return m_file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+/**
+ * @brief Journal::abortCompaction keeps the journal as it is, if the document couldn't be saved.
+ */
+void Journal::abortCompaction()
+{
+  m_compacting = false;
+  m_compacted.clear();
+}
+}
@@ -0,0 +1,70 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "page.h"
+
+#include <QByteArray>
+#include <QFile>
+
+namespace MrDoc
+{
+
+class Document;
+
+/**
+ * @brief The Journal class appends every change of the pages of a document to a file beside it, so the changes since the last save survive a
+ * crash.
+ * @details The undo commands report what they change on a page (strokes added or removed, page size and background, pages inserted or removed) and
+ * the widget writes the records of each step of the undo stack as one frame with a checksum, so writing costs as much as the edit, not as the
+ * document. Every frame is synced to the disk, so it survives a crash of the system or a power failure, not only one of MrWriter. Strokes are
+ * referred to by their ids on the page; a stroke that is added is recorded together with the stroke in front of it, which is all replay() needs to
+ * put it in the same place. A selection is recorded when it is released, as its strokes removed from where they were taken and added where they
+ * were dropped, so the journal never holds a document without the strokes that are selected.
+ *
+ * The journal starts out empty when a document is opened, since the ids of a loaded page follow the order of its strokes in the file. Saving the
+ * document compacts the journal: beginCompaction() records the ids of the pages whose ids don't follow that order anymore, and once the file is
+ * written finishCompaction() replaces the journal by these records and the changes made while saving. The journal remembers the size and time of
+ * the document it belongs to, so a journal that doesn't fit the document anymore is ignored.
+ */
+class Journal
+{
+public:
+  Journal();
+
+  static QString fileName(const QString &documentFileName);
+  static int replay(const QString &documentFileName, Document &document);
+
+  bool start(const QString &documentFileName);
+  void discard();
+  bool isActive() const;
+  qint64 size() const;
+
+  void strokeAdded(int pageNum, const Page &page, StrokeId id);
+  void strokesAdded(int pageNum, const Page &page, const QVector<StrokeId> &ids);
+  void strokesRestored(int pageNum, const Page &page, const QVector<QPair<Stroke, StrokeId>> &strokesAndIds);
+  void strokeRemoved(int pageNum, StrokeId id);
+  void strokesRemoved(int pageNum, const QVector<StrokeId> &ids);
+  void pageChanged(int pageNum, const Page &page);
+  void pageInserted(int pageNum, const Page &page);
+  void pageRemoved(int pageNum);
+
+  bool flush();
+
+  void beginCompaction(const Document &document);
+  bool finishCompaction(const QString &documentFileName);
+  void abortCompaction();
+
+private:
+  Q_DISABLE_COPY(Journal)
+
+  bool isRecording() const;
+
+  QFile m_file;
+  QByteArray m_records; // of the current step of the undo stack
+
+  bool m_compacting = false;
+  QByteArray m_compacted; // frames of the journal that replaces this one once the document is saved
+};
+}
+
+#endif // JOURNAL_H
@@ -13,6 +13,8 @@
 #include <QPageSize>
 #include <QSettings>
 #include <QDateTime>
+#include <QFileInfo>
+#include <QtConcurrent>
 //#include <QWebEngineView>
 #include <QDesktopServices>
 #include <QBoxLayout>
@@ -44,6 +46,11 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
   connect(mainWidget, SIGNAL(updateGUI()), this, SLOT(updateGUI()));
 
   connect(mainWidget, SIGNAL(modified()), this, SLOT(modified()));
+  connect(&saveWatcher, SIGNAL(finished()), this, SLOT(savingFinished()));
+  connect(&mainWidget->undoStack, SIGNAL(indexChanged(int)), this, SLOT(compactJournal()));
+
+  QSettings settings;
+  journalCompactionSize = settings.value("Document/journalCompactionSize", 4 * 1024 * 1024).toLongLong();
 
   scrollArea = new QScrollArea(this);
   scrollArea->setWidget(mainWidget);
@@ -685,6 +692,7 @@ void MainWindow::newFile()
 {
   if (maybeSave())
   {
+    mainWidget->journal.discard();
     mainWidget->newFile();
     updateGUI();
   }
@@ -724,7 +732,9 @@ void MainWindow::openFile()
   if (openDocument.loadMOJ(fileName))
   {
     mainWidget->letGoSelection();
+    mainWidget->journal.discard();
     mainWidget->setDocument(openDocument);
+    openJournal(fileName);
     setTitle();
     modified();
   }
@@ -750,25 +760,153 @@ QString MainWindow::askForFileName()
   return fileName;
 }
 
-bool MainWindow::saveFileAs()
+/**
+ * @brief MainWindow::saveDocument starts saving a snapshot of the current document as MOJ on a worker thread, in the line based format if the
+ * setting Document/lineBasedFormat is set, or else in the binary format if the setting Document/binaryFormat is set. Editing can go on in the
+ * meantime. The file is written to a temporary file that replaces the old one once it is complete, see savingFinished() for the rest. The journal
+ * is compacted once the file is saved. A binary MOJ the document was loaded from or saved to before is updated in place, by writing only the
+ * pages that changed, see MrDoc::Document::updateBinaryMOJ().
+ * @param fileName
+ * @return true, failures are reported by savingFinished()
+ */
+bool MainWindow::saveDocument(QString fileName)
 {
-  QString fileName = askForFileName();
+  // a save that is still running might write to the same file
+  finishSaving();
 
-  if (fileName.isNull())
+  QSettings settings;
+  bool lineBasedFormat = settings.value("Document/lineBasedFormat", false).toBool();
+  bool binaryFormat = settings.value("Document/binaryFormat", false).toBool();
+  QSharedPointer<MrDoc::Document> snapshot(new MrDoc::Document(mainWidget->currentDocument));
+  // lazily loaded pages decode their strokes in place, so the saving thread needs Page objects of its own instead of the shared ones the widget
+  // loads and paints
+  snapshot->pages.detach();
+  // selected strokes are saved where they were taken from, which is where the journal has them until the selection is released
+  const MrDoc::Selection &selection = mainWidget->currentSelection;
+  if (mainWidget->getCurrentState() == Widget::state::SELECTED && selection.sourcePageNum() != -1)
   {
-    return false;
+    snapshot->pages[selection.sourcePageNum()].restoreStrokes(selection.sourceStrokes());
   }
+  savingSnapshot = snapshot;
+  savingFileName = fileName;
+  savingRevision = mainWidget->currentDocument.revision();
+  mainWidget->journal.beginCompaction(*snapshot);
+  saveWatcher.setFuture(QtConcurrent::run([snapshot, fileName, lineBasedFormat, binaryFormat]()
+                                          {
+                                            if (lineBasedFormat)
+                                            {
+                                              return snapshot->saveLineBasedMOJ(fileName);
+                                            }
+                                            return binaryFormat ? snapshot->updateBinaryMOJ(fileName) : snapshot->saveMOJ(fileName);
+                                          }));
+  statusBar()->showMessage(tr("Saving %1").arg(fileName));
+  return true;
+}
 
-  if (mainWidget->currentDocument.saveMOJ(fileName))
+/**
+ * @brief MainWindow::savingFinished takes over the file name of a finished save into the document, and marks the document as unchanged unless it
+ * was edited while it was saved.
+ */
+void MainWindow::savingFinished()
+{
+  if (savingFileName.isEmpty())
   {
+    return; // already handled by finishSaving()
+  }
+  QString fileName = savingFileName;
+  savingFileName.clear();
+  lastSaveSucceeded = saveWatcher.result();
+  QSharedPointer<MrDoc::Document> snapshot = savingSnapshot;
+  savingSnapshot.reset();
+
+  if (lastSaveSucceeded)
+  {
+    mainWidget->journal.finishCompaction(fileName);
+    mainWidget->currentDocument.takeBinaryLayout(*snapshot);
+    QFileInfo fileInfo(fileName);
+    mainWidget->currentDocument.setPath(fileInfo.absolutePath());
+    mainWidget->currentDocument.setDocName(fileInfo.completeBaseName());
+    if (mainWidget->currentDocument.revision() == savingRevision)
+    {
+      mainWidget->currentDocument.setDocumentChanged(false);
+    }
     modified();
     setTitle();
-    return true;
+    statusBar()->showMessage(tr("Saved %1").arg(fileName), 2000);
   }
   else
+  {
+    mainWidget->journal.abortCompaction();
+    statusBar()->clearMessage();
+    QMessageBox errMsgBox;
+    errMsgBox.setText("Couldn't save file");
+    errMsgBox.exec();
+  }
+}
+
+/**
+ * @brief MainWindow::finishSaving waits for a running save.
+ * @return true if the last save succeeded
+ */
+bool MainWindow::finishSaving()
+{
+  if (!savingFileName.isEmpty())
+  {
+    saveWatcher.waitForFinished();
+    savingFinished();
+  }
+  return lastSaveSucceeded;
+}
+
+/**
+ * @brief MainWindow::openJournal offers to recover the changes in the journal of a document that was just opened, which is left behind if
+ * MrWriter quits without saving them. Recovered changes are saved right away. Afterwards, the changes to the document are journaled.
+ * @param fileName of the document
+ */
+void MainWindow::openJournal(const QString &fileName)
+{
+  MrDoc::Document recoveredDocument(mainWidget->currentDocument);
+  if (MrDoc::Journal::replay(fileName, recoveredDocument) > 0)
+  {
+    QString text = tr("%1 has changes that were not saved before MrWriter quit.\n"
+                      "Do you want to recover them?")
+                       .arg(QFileInfo(fileName).fileName());
+    QMessageBox::StandardButton ret = QMessageBox::question(this, tr("Application"), text);
+    if (ret == QMessageBox::Yes)
+    {
+      recoveredDocument.setDocumentChanged(true);
+      mainWidget->setDocument(recoveredDocument);
+      // saving compacts the journal; if it fails, the journal is kept for the next try
+      saveDocument(fileName);
+      finishSaving();
+      return;
+    }
+  }
+  mainWidget->journal.start(fileName);
+}
+
+/**
+ * @brief MainWindow::compactJournal saves the document once its journal has grown too big, which compacts the journal. This waits while strokes
+ * are selected, releasing them changes the undo stack and calls this again.
+ */
+void MainWindow::compactJournal()
+{
+  if (savingFileName.isEmpty() && mainWidget->getCurrentState() != Widget::state::SELECTED && mainWidget->journal.size() > journalCompactionSize)
+  {
+    saveFile();
+  }
+}
+
+bool MainWindow::saveFileAs()
+{
+  QString fileName = askForFileName();
+
+  if (fileName.isNull())
   {
     return false;
   }
+
+  return saveDocument(fileName);
 }
 
 bool MainWindow::saveFile()
@@ -793,16 +931,7 @@ bool MainWindow::saveFile()
     return false;
   }
 
-  if (mainWidget->currentDocument.saveMOJ(fileName))
-  {
-    modified();
-    setTitle();
-    return true;
-  }
-  else
-  {
-    return false;
-  }
+  return saveDocument(fileName);
 }
 
 void MainWindow::exportPDF()
@@ -859,6 +988,7 @@ void MainWindow::importXOJ()
   if (openDocument.loadXOJ(fileName))
   {
     mainWidget->letGoSelection();
+    mainWidget->journal.discard();
     mainWidget->setDocument(openDocument);
     setTitle();
     modified();
@@ -1163,6 +1293,7 @@ void MainWindow::closeEvent(QCloseEvent *event)
 {
   if (maybeSave())
   {
+    mainWidget->journal.discard();
     event->accept();
     TabletApplication *myApp = static_cast<TabletApplication *>(qApp);
     myApp->mainWindows.removeOne(this);
@@ -1180,6 +1311,7 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 bool MainWindow::maybeSave()
 {
+  finishSaving();
   if (mainWidget->currentDocument.documentChanged())
   {
     QMessageBox::StandardButton ret;
@@ -1187,7 +1319,7 @@ bool MainWindow::maybeSave()
                                                            "Do you want to save your changes?"),
                                QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
     if (ret == QMessageBox::Save)
-      return saveFile();
+      return saveFile() && finishSaving();
     else if (ret == QMessageBox::Cancel)
       return false;
   }
@@ -1287,11 +1419,11 @@ void MainWindow::cloneWindow()
   MainWindow *window = new MainWindow();
   window->mainWidget->currentDocument = mainWidget->currentDocument;
   window->mainWidget->currentDocument.setDocName("");
-  window->mainWidget->pageBuffer = mainWidget->pageBuffer;
   window->mainWidget->currentSelection = mainWidget->currentSelection;
   window->mainWidget->setCurrentState(mainWidget->getCurrentState());
   //  window->mainWidget->zoomTo(mainWidget->zoom);
   window->mainWidget->zoom = mainWidget->zoom;
+  window->mainWidget->updateAllPageBuffers();
 
   window->show();
 
@@ -1319,8 +1451,12 @@ bool MainWindow::loadXOJ(QString fileName)
 
 bool MainWindow::loadMOJ(QString fileName)
 {
-  return mainWidget->currentDocument.loadMOJ(fileName);
-  updateGUI();
+  if (!mainWidget->currentDocument.loadMOJ(fileName))
+  {
+    return false;
+  }
+  openJournal(fileName);
+  return true;
 }
 
 void MainWindow::pageSettings()
@@ -1,6 +1,7 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QFutureWatcher>
 #include <QMainWindow>
 #include <QLabel>
 #include <QToolButton>
@@ -91,6 +92,9 @@ private slots:
 
   bool maybeSave();
 
+  void savingFinished();
+  void compactJournal();
+
 private:
   // widgets
   Widget *mainWidget;
@@ -101,6 +105,16 @@ private:
   void createMenus();
 
   QString askForFileName();
+  bool saveDocument(QString fileName);
+  bool finishSaving();
+  void openJournal(const QString &fileName);
+
+  QFutureWatcher<bool> saveWatcher;
+  QString savingFileName; // empty unless a save is running or its result hasn't been handled yet
+  quint64 savingRevision = 0;
+  QSharedPointer<MrDoc::Document> savingSnapshot; // the copy of the document that is saved
+  bool lastSaveSucceeded = false;
+  qint64 journalCompactionSize; // the journal is compacted into the document once it is bigger than this
 
   QLabel pageStatus;
   QLabel penWidthStatus;
@@ -0,0 +1,260 @@
+#include "numberparser.h"
+
+namespace MrDoc
+{
+
+namespace
+{
+// the powers of ten that are exact as a double
+const double powersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                              1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const int maxExactPower = 22;
+const quint64 maxExactMantissa = Q_UINT64_C(1) << 53;
+
+inline ushort code(QChar c)
+{
+  return c.unicode();
+}
+
+inline ushort code(char c)
+{
+  return static_cast<uchar>(c);
+}
+
+inline bool isSeparator(ushort c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+double toDouble(const QChar *begin, const QChar *end)
+{
+  return QString::fromRawData(begin, end - begin).toDouble();
+}
+
+double toDouble(const char *begin, const char *end)
+{
+  return QByteArray::fromRawData(begin, end - begin).toDouble();
+}
+
+/**
+ * @brief parseNumber converts a decimal number with optional sign, fraction and exponent. Numbers with up to 19 significant digits and small
+ * exponents, which is everything MrWriter and Xournal write, are computed directly. Others, and text that isn't a plain decimal, are handed to
+ * toDouble().
+ * @param begin
+ * @param end
+ * @return the number, or 0 if the text isn't a number
+ */
+template <typename Char> double parseNumber(const Char *begin, const Char *end)
+{
+  const Char *it = begin;
+  bool negative = false;
+  if (it != end && (code(*it) == '-' || code(*it) == '+'))
+  {
+    negative = (code(*it) == '-');
+    ++it;
+  }
+
+  quint64 mantissa = 0;
+  int numDigits = 0;
+  int exponent = 0;
+  bool exact = true;
+  bool anyDigits = false;
+  for (; it != end && code(*it) >= '0' && code(*it) <= '9'; ++it)
+  {
+    anyDigits = true;
+    if (numDigits < 19)
+    {
+      mantissa = 10 * mantissa + (code(*it) - '0');
+      numDigits += (mantissa != 0);
+    }
+    else
+    {
+      ++exponent;
+      exact = false;
+    }
+  }
+  if (it != end && code(*it) == '.')
+  {
+    for (++it; it != end && code(*it) >= '0' && code(*it) <= '9'; ++it)
+    {
+      anyDigits = true;
+      if (numDigits < 19)
+      {
+        mantissa = 10 * mantissa + (code(*it) - '0');
+        numDigits += (mantissa != 0);
+        --exponent;
+      }
+      else
+      {
+        exact = false;
+      }
+    }
+  }
+  // anything that isn't a plain decimal, like "nan" or "inf", is left to toDouble()
+  if (!anyDigits)
+  {
+    return toDouble(begin, end);
+  }
+  if (it != end && (code(*it) == 'e' || code(*it) == 'E'))
+  {
+    ++it;
+    bool negativeExponent = false;
+    if (it != end && (code(*it) == '-' || code(*it) == '+'))
+    {
+      negativeExponent = (code(*it) == '-');
+      ++it;
+    }
+    int explicitExponent = 0;
+    bool anyExponentDigits = false;
+    for (; it != end && code(*it) >= '0' && code(*it) <= '9'; ++it)
+    {
+      anyExponentDigits = true;
+      if (explicitExponent < 10000)
+      {
+        explicitExponent = 10 * explicitExponent + (code(*it) - '0');
+      }
+    }
+    if (!anyExponentDigits)
+    {
+      return toDouble(begin, end);
+    }
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+  if (it != end)
+  {
+    return toDouble(begin, end);
+  }
+
+  // a mantissa below 2^53 and a power of ten up to 1e22 are both exact, so a single multiplication or division rounds correctly
+  if (exact && mantissa <= maxExactMantissa && exponent >= -maxExactPower && exponent <= maxExactPower)
+  {
+    double value = static_cast<double>(mantissa);
+    value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+    return negative ? -value : value;
+  }
+  return toDouble(begin, end);
+}
+
+template <typename Char> void parse(const Char *begin, const Char *end, QVector<float> &numbers)
+{
+  const Char *it = begin;
+  while (true)
+  {
+    while (it != end && isSeparator(code(*it)))
+    {
+      ++it;
+    }
+    if (it == end)
+    {
+      return;
+    }
+    const Char *start = it;
+    while (it != end && !isSeparator(code(*it)))
+    {
+      ++it;
+    }
+    numbers.append(parseNumber(start, it));
+  }
+}
+}
+
+/**
+ * @brief NumberParser::addText appends the numbers in text to numbers.
+ * @param text
+ * @param numbers
+ */
+void NumberParser::addText(const QStringRef &text, QVector<float> &numbers)
+{
+  const QChar *it = text.constData();
+  const QChar *end = it + text.size();
+
+  if (!m_pending.isEmpty())
+  {
+    const QChar *stop = it;
+    while (stop != end && !isSeparator(*stop))
+    {
+      ++stop;
+    }
+    m_pending.append(it, stop - it);
+    if (stop == end)
+    {
+      return;
+    }
+    numbers.append(parseNumber(m_pending.constData(), m_pending.constData() + m_pending.size()));
+    m_pending.clear();
+    it = stop;
+  }
+
+  const QChar *tail = end;
+  while (tail != it && !isSeparator(*(tail - 1)))
+  {
+    --tail;
+  }
+  if (tail != end)
+  {
+    m_pending.append(tail, end - tail);
+  }
+  parse(it, tail, numbers);
+}
+
+/**
+ * @brief NumberParser::finish appends the number that is still pending at the end of the text.
+ * @param numbers
+ */
+void NumberParser::finish(QVector<float> &numbers)
+{
+  if (!m_pending.isEmpty())
+  {
+    numbers.append(parseNumber(m_pending.constData(), m_pending.constData() + m_pending.size()));
+    m_pending.clear();
+  }
+}
+
+/**
+ * @brief NumberParser::parse appends all numbers in text to numbers.
+ * @param text
+ * @param numbers
+ */
+void NumberParser::parse(const QStringRef &text, QVector<float> &numbers)
+{
+  parse(text.constData(), text.constData() + text.size(), numbers);
+}
+
+void NumberParser::parse(const QChar *begin, const QChar *end, QVector<float> &numbers)
+{
+  MrDoc::parse(begin, end, numbers);
+}
+
+/**
+ * @brief NumberParser::parse appends all numbers in Latin-1 text to numbers.
+ * @param begin
+ * @param end
+ * @param numbers
+ */
+void NumberParser::parse(const char *begin, const char *end, QVector<float> &numbers)
+{
+  MrDoc::parse(begin, end, numbers);
+}
+
+/**
+ * @brief NumberParser::parseNumber converts a decimal number with optional sign, fraction and exponent, exactly like QString::toDouble() but
+ * faster for the numbers that are found in documents.
+ * @param begin
+ * @param end
+ * @return the number, or 0 if the text isn't a number
+ */
+double NumberParser::parseNumber(const QChar *begin, const QChar *end)
+{
+  return MrDoc::parseNumber(begin, end);
+}
+
+double NumberParser::parseNumber(const char *begin, const char *end)
+{
+  return MrDoc::parseNumber(begin, end);
+}
+
+bool NumberParser::isSeparator(QChar c)
+{
+  return MrDoc::isSeparator(c.unicode());
+}
+}
@@ -0,0 +1,37 @@
+#ifndef NUMBERPARSER_H
+#define NUMBERPARSER_H
+
+#include <QString>
+#include <QVector>
+
+namespace MrDoc
+{
+
+/**
+ * @brief The NumberParser class reads whitespace separated lists of numbers, like the coordinates and pressures of a stroke in a document file,
+ * from UTF-16 or Latin-1 text.
+ * @details The text is scanned in place and the numbers are appended to a vector that can be reused from stroke to stroke, so no strings are
+ * created per number. Text can be added in several pieces, as QXmlStreamReader may report the text of an element in more than one token. A number
+ * that is cut off at the end of a piece is kept until the next piece or finish(). Anything that isn't a number is read as 0, like
+ * QString::toDouble() does.
+ */
+class NumberParser
+{
+public:
+  void addText(const QStringRef &text, QVector<float> &numbers);
+  void finish(QVector<float> &numbers);
+
+  static void parse(const QStringRef &text, QVector<float> &numbers);
+  static void parse(const QChar *begin, const QChar *end, QVector<float> &numbers);
+  static void parse(const char *begin, const char *end, QVector<float> &numbers);
+  static double parseNumber(const QChar *begin, const QChar *end);
+  static double parseNumber(const char *begin, const char *end);
+
+private:
+  static bool isSeparator(QChar c);
+
+  QString m_pending; // the start of a number that was cut off at the end of the last piece
+};
+}
+
+#endif // NUMBERPARSER_H
@@ -1,10 +1,20 @@
 #include "page.h"
 #include "mrdoc.h"
+#include "pageloader.h"
+#include <QAtomicInteger>
 #include <QDebug>
+#include <QSet>
+
+#include <algorithm>
 
 namespace MrDoc
 {
 
+namespace
+{
+QAtomicInteger<quint64> lastGeneration; // of all pages of all documents
+}
+
 Page::Page()
 {
   // set up standard page (Letter, white background)
@@ -30,6 +40,8 @@ void Page::setHeight(qreal height)
   if (height > 0)
   {
     m_height = height;
+    updateStrokeGrid();
+    touch();
   }
 }
 
@@ -38,23 +50,36 @@ void Page::setWidth(qreal width)
   if (width > 0)
   {
     m_width = width;
+    updateStrokeGrid();
+    touch();
   }
 }
 
-void Page::paint(QPainter &painter, qreal zoom, QRectF region)
+void Page::paint(QPainter &painter, qreal zoom, QRectF region) const
 {
-  for (Stroke &stroke : m_strokes)
+  load();
+  // the styles are looked up once per page, since this runs on the render threads for every tile
+  QVector<StyleTable::Style> styles = StyleTable::instance().styles();
+  if (region.isNull())
   {
-    if (region.isNull() || stroke.boundingRect().intersects(region))
+    for (const Stroke &stroke : m_strokes)
     {
-      stroke.paint(painter, zoom);
+      stroke.paint(painter, zoom, styles.at(stroke.style()));
     }
+    return;
+  }
+
+  for (int i : strokesIntersecting(region))
+  {
+    const Stroke &stroke = m_strokes.at(i);
+    stroke.paint(painter, zoom, styles.at(stroke.style()));
   }
 }
 
 void Page::setBackgroundColor(QColor backgroundColor)
 {
   m_backgroundColor = backgroundColor;
+  touch();
 }
 
 QColor Page::backgroundColor() const
@@ -74,130 +99,615 @@ void Page::clearDirtyRect()
 
 bool Page::changePenWidth(int strokeNum, qreal penWidth)
 {
-  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_strokes.isEmpty())
+  load();
+  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_slots.at(strokeNum).removed)
   {
     return false;
   }
   else
   {
-    m_strokes[strokeNum].penWidth = penWidth;
+    QRectF oldRect = m_strokes[strokeNum].boundingRect();
+    m_strokes[strokeNum].setPenWidth(penWidth);
+    m_strokeGrid.move(m_slots.at(strokeNum).id, oldRect, m_strokes[strokeNum].boundingRect());
     m_dirtyRect = m_dirtyRect.united(m_strokes[strokeNum].boundingRect());
+    touch();
     return true;
   }
 }
 
 bool Page::changeStrokeColor(int strokeNum, QColor color)
 {
-  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_strokes.isEmpty())
+  load();
+  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_slots.at(strokeNum).removed)
   {
     return false;
   }
   else
   {
-    m_strokes[strokeNum].color = color;
+    m_strokes[strokeNum].setColor(color);
     m_dirtyRect = m_dirtyRect.united(m_strokes[strokeNum].boundingRect());
+    touch();
     return true;
   }
 }
 
 bool Page::changeStrokePattern(int strokeNum, QVector<qreal> pattern)
 {
-  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_strokes.isEmpty())
+  load();
+  if (strokeNum < 0 || strokeNum >= m_strokes.size() || m_slots.at(strokeNum).removed)
   {
     return false;
   }
   else
   {
-    m_strokes[strokeNum].pattern = pattern;
+    m_strokes[strokeNum].setPattern(pattern);
     m_dirtyRect = m_dirtyRect.united(m_strokes[strokeNum].boundingRect());
+    touch();
     return true;
   }
 }
 
-const QVector<Stroke> &Page::strokes()
+/**
+ * @brief Page::strokes
+ * @return the strokes in the order they are painted, including the tombstones of removed strokes, which are empty
+ */
+const QVector<Stroke> &Page::strokes() const
 {
+  load();
   return m_strokes;
 }
 
-QVector<QPair<Stroke, int>> Page::getStrokes(QPolygonF selectionPolygon)
+/**
+ * @brief Page::strokesIntersecting looks up the strokes whose bounding rect intersects rect in the stroke grid.
+ * @param rect
+ * @return the sorted numbers of the strokes
+ */
+QVector<int> Page::strokesIntersecting(const QRectF &rect) const
+{
+  load();
+  QRectF normalizedRect = rect.normalized();
+  QVector<int> strokeNums = this->strokeNums(m_strokeGrid.query(normalizedRect));
+  strokeNums.erase(std::remove_if(strokeNums.begin(), strokeNums.end(),
+                                  [this, &normalizedRect](int i)
+                                  {
+                                    return !m_strokes.at(i).boundingRect().intersects(normalizedRect);
+                                  }),
+                   strokeNums.end());
+  return strokeNums;
+}
+
+StrokeId Page::strokeId(int strokeNum) const
+{
+  load();
+  return m_slots.at(strokeNum).id;
+}
+
+/**
+ * @brief Page::strokeNum
+ * @param id
+ * @return the slot of the stroke, -1 if it isn't on the page
+ */
+int Page::strokeNum(StrokeId id) const
+{
+  load();
+  int strokeNum = slotOf(id);
+  if (strokeNum == -1 || m_slots.at(strokeNum).removed)
+  {
+    return -1;
+  }
+  return strokeNum;
+}
+
+/**
+ * @brief Page::slotOf looks up the order key of a stroke and finds its slot with a binary search.
+ * @param id
+ * @return the slot of the stroke or its tombstone, -1 if the tombstone was dropped or the id isn't known
+ */
+int Page::slotOf(StrokeId id) const
+{
+  auto order = m_orders.constFind(id);
+  if (order == m_orders.constEnd())
+  {
+    return -1;
+  }
+  auto it = std::lower_bound(m_slots.constBegin(), m_slots.constEnd(), order.value(), [](const Slot &slot, double order)
+                             {
+                               return slot.order < order;
+                             });
+  // a restored stroke may share its key with a stroke that was inserted while its tombstone was dropped
+  for (; it != m_slots.constEnd() && it->order == order.value(); ++it)
+  {
+    if (it->id == id)
+    {
+      return it - m_slots.constBegin();
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Page::strokeNums
+ * @param ids of strokes on the page, like the stroke grid returns them
+ * @return the sorted slots of the strokes
+ */
+QVector<int> Page::strokeNums(const QVector<StrokeId> &ids) const
+{
+  QVector<int> strokeNums;
+  strokeNums.reserve(ids.size());
+  for (StrokeId id : ids)
+  {
+    int strokeNum = slotOf(id);
+    if (strokeNum != -1)
+    {
+      strokeNums.append(strokeNum);
+    }
+  }
+  std::sort(strokeNums.begin(), strokeNums.end());
+  return strokeNums;
+}
+
+void Page::updateStrokeGrid()
+{
+  m_strokeGrid.reset(m_width, m_height);
+  for (int i = 0; i < m_strokes.size(); ++i)
+  {
+    if (!m_strokes.at(i).isEmpty())
+    {
+      m_strokeGrid.add(m_slots.at(i).id, m_strokes.at(i).boundingRect());
+    }
+  }
+}
+
+QVector<QPair<Stroke, StrokeId>> Page::getStrokes(QPolygonF selectionPolygon)
 {
-  QVector<QPair<Stroke, int>> strokesAndPositions;
+  QVector<QPair<Stroke, StrokeId>> strokesAndIds;
+  QRectF selectionRect = selectionPolygon.boundingRect();
+  QVector<int> candidates = strokesIntersecting(selectionRect);
 
-  for (int i = m_strokes.size() - 1; i >= 0; --i)
+  for (int c = candidates.size() - 1; c >= 0; --c)
   {
+    int i = candidates.at(c);
     const MrDoc::Stroke &stroke = m_strokes.at(i);
+    if (!selectionRect.contains(stroke.boundingRectSansPenWidth()))
+    {
+      continue;
+    }
     bool containsStroke = true;
-    for (int j = 0; j < stroke.points.size(); ++j)
+    for (int j = 0; j < stroke.size(); ++j)
     {
-      if (!selectionPolygon.containsPoint(stroke.points.at(j), Qt::OddEvenFill))
+      if (!selectionPolygon.containsPoint(stroke.point(j), Qt::OddEvenFill))
       {
         containsStroke = false;
+        break;
       }
     }
     if (containsStroke)
     {
-      // add selected strokes and positions to return vector
-      strokesAndPositions.append(QPair<Stroke, int>(stroke, i));
+      // add selected strokes and their ids to return vector
+      strokesAndIds.append(QPair<Stroke, StrokeId>(stroke, m_slots.at(i).id));
     }
   }
 
-  return strokesAndPositions;
+  return strokesAndIds;
 }
 
-QVector<QPair<Stroke, int>> Page::removeStrokes(QPolygonF selectionPolygon)
+QVector<QPair<Stroke, StrokeId>> Page::removeStrokes(QPolygonF selectionPolygon)
 {
-  auto removedStrokesAndPositions = getStrokes(selectionPolygon);
+  auto removedStrokesAndIds = getStrokes(selectionPolygon);
 
-  for (auto sAndP : removedStrokesAndPositions)
+  for (auto sAndId : removedStrokesAndIds)
   {
-    removeStrokeAt(sAndP.second);
+    removeStroke(sAndId.second);
   }
 
-  return removedStrokesAndPositions;
+  return removedStrokesAndIds;
 }
 
-void Page::removeStrokeAt(int i)
+/**
+ * @brief Page::removeStroke replaces a stroke by a tombstone. No other stroke changes its slot.
+ * @param id
+ */
+void Page::removeStroke(StrokeId id)
 {
-  m_dirtyRect = m_dirtyRect.united(m_strokes[i].boundingRect());
-  m_strokes.removeAt(i);
+  load();
+  int strokeNum = this->strokeNum(id);
+  if (strokeNum == -1)
+  {
+    return;
+  }
+  QRectF rect = m_strokes.at(strokeNum).boundingRect();
+  m_dirtyRect = m_dirtyRect.united(rect);
+  m_strokeGrid.drop(id, rect);
+  m_strokes[strokeNum] = Stroke();
+  m_slots[strokeNum].removed = true;
+  ++m_numTombstones;
+  touch();
 }
 
-void Page::removeLastStroke()
+void Page::removeStrokes(const QVector<StrokeId> &ids)
 {
-  removeStrokeAt(m_strokes.size() - 1);
+  for (StrokeId id : ids)
+  {
+    removeStroke(id);
+  }
 }
 
-void Page::insertStrokes(const QVector<QPair<Stroke, int>> &strokesAndPositions)
+/**
+ * @brief Page::restoreStroke puts a removed stroke back where it was. As long as its tombstone is there, this doesn't touch any other stroke.
+ * @param id
+ * @param stroke
+ */
+void Page::restoreStroke(StrokeId id, const Stroke &stroke)
 {
-  for (int i = strokesAndPositions.size() - 1; i >= 0; --i)
+  load();
+  int strokeNum = slotOf(id);
+  if (strokeNum != -1)
+  {
+    if (!m_slots.at(strokeNum).removed)
+    {
+      return;
+    }
+    m_strokes[strokeNum] = stroke;
+    m_strokes[strokeNum].moveToArena(m_arena);
+    m_slots[strokeNum].removed = false;
+    --m_numTombstones;
+    m_strokeGrid.add(id, stroke.boundingRect());
+    m_dirtyRect = m_dirtyRect.united(stroke.boundingRect());
+    touch();
+    return;
+  }
+
+  if (m_orders.contains(id))
   {
-    insertStroke(strokesAndPositions[i].second, strokesAndPositions[i].first);
+    double order = m_orders.value(id);
+    insertSlot(slotForOrder(order), id, order, stroke);
+  }
+  else
+  {
+    insertSlot(m_strokes.size(), id, orderAt(m_strokes.size()), stroke);
   }
 }
 
-void Page::insertStroke(int position, const Stroke &stroke)
+void Page::restoreStrokes(const QVector<QPair<Stroke, StrokeId>> &strokesAndIds)
 {
-  m_dirtyRect = m_dirtyRect.united(stroke.boundingRect());
-  m_strokes.insert(position, stroke);
+  for (const auto &sAndId : strokesAndIds)
+  {
+    restoreStroke(sAndId.second, sAndId.first);
+  }
 }
 
-void Page::appendStroke(const Stroke &stroke)
+void Page::restoreStrokes(const QVector<Stroke> &strokes, const QVector<StrokeId> &ids)
 {
-  m_dirtyRect = m_dirtyRect.united(stroke.boundingRect());
-  m_strokes.append(stroke);
+  Q_ASSERT(strokes.size() == ids.size());
+  for (int i = 0; i < strokes.size(); ++i)
+  {
+    restoreStroke(ids.at(i), strokes.at(i));
+  }
 }
 
-void Page::prependStroke(const Stroke &stroke)
+StrokeId Page::appendStroke(const Stroke &stroke)
 {
-  m_dirtyRect = m_dirtyRect.united(stroke.boundingRect());
-  m_strokes.prepend(stroke);
+  load();
+  return insertSlot(m_strokes.size(), ++m_lastId, orderAt(m_strokes.size()), stroke);
 }
 
-void Page::appendStrokes(const QVector<Stroke> &strokes)
+/**
+ * @brief Page::appendStroke adds a stroke made from numPoints coordinates and pressures, which are copied into the arena of the page right away.
+ * This is how strokes are loaded, the only allocation is the part of an arena block.
+ * @param xs
+ * @param ys
+ * @param pressures
+ * @param numPoints
+ * @param style index into the StyleTable
+ * @param penWidth
+ * @return the id of the new stroke
+ */
+StrokeId Page::appendStroke(const float *xs, const float *ys, const float *pressures, int numPoints, int style, qreal penWidth)
 {
+  load();
+  Stroke stroke;
+  stroke.setStyle(style);
+  stroke.setPenWidth(penWidth);
+  stroke.setPoints(xs, ys, pressures, numPoints, &m_arena);
+  return insertSlot(m_strokes.size(), ++m_lastId, orderAt(m_strokes.size()), stroke, true);
+}
+
+QVector<StrokeId> Page::appendStrokes(const QVector<Stroke> &strokes)
+{
+  QVector<StrokeId> ids;
+  ids.reserve(strokes.size());
   for (auto &stroke : strokes)
   {
-    appendStroke(stroke);
+    ids.append(appendStroke(stroke));
+  }
+  return ids;
+}
+
+StrokeId Page::prependStroke(const Stroke &stroke)
+{
+  load();
+  return insertSlot(0, ++m_lastId, orderAt(0), stroke);
+}
+
+/**
+ * @brief Page::insertStrokeAfter adds a stroke right behind another one, which may be a tombstone. Unlike the other operations, this moves the
+ * strokes behind it to the next slot.
+ * @param id
+ * @param stroke
+ * @return the id of the new stroke
+ */
+StrokeId Page::insertStrokeAfter(StrokeId id, const Stroke &stroke)
+{
+  load();
+  int strokeNum = slotOf(id);
+  if (strokeNum != -1)
+  {
+    ++strokeNum;
+  }
+  else
+  {
+    // behind where the tombstone was, or at the end if the id isn't known
+    strokeNum = m_orders.contains(id) ? slotForOrder(m_orders.value(id)) : m_strokes.size();
+  }
+  return insertSlot(strokeNum, ++m_lastId, orderAt(strokeNum), stroke);
+}
+
+/**
+ * @brief Page::insertSlot
+ * @param strokeNum
+ * @param id
+ * @param order
+ * @param stroke
+ * @param inArena the data of stroke was allocated from m_arena already, otherwise it is copied there
+ * @return id
+ */
+StrokeId Page::insertSlot(int strokeNum, StrokeId id, double order, const Stroke &stroke, bool inArena)
+{
+  m_strokes.insert(strokeNum, stroke);
+  if (!inArena)
+  {
+    m_strokes[strokeNum].moveToArena(m_arena);
+  }
+  m_slots.insert(strokeNum, Slot{id, order, false});
+  m_orders.insert(id, order);
+  m_maxOrder = qMax(m_maxOrder, order);
+  m_strokeGrid.add(id, stroke.boundingRect());
+  m_dirtyRect = m_dirtyRect.united(stroke.boundingRect());
+  touch();
+  return id;
+}
+
+/**
+ * @brief Page::orderAt
+ * @param strokeNum
+ * @return an order key for a new stroke at strokeNum, between the keys of its neighbours
+ */
+double Page::orderAt(int strokeNum)
+{
+  if (strokeNum == m_slots.size())
+  {
+    return m_maxOrder + 1.0;
+  }
+  if (strokeNum == 0)
+  {
+    return m_slots.first().order - 1.0;
+  }
+  double before = m_slots.at(strokeNum - 1).order;
+  double after = m_slots.at(strokeNum).order;
+  double order = (before + after) / 2.0;
+  if (order <= before || order >= after)
+  {
+    // the gap is used up
+    renumberOrders();
+    return orderAt(strokeNum);
+  }
+  return order;
+}
+
+/**
+ * @brief Page::slotForOrder
+ * @param order
+ * @return the slot a stroke with the given order key has to be inserted at
+ */
+int Page::slotForOrder(double order) const
+{
+  auto it = std::upper_bound(m_slots.begin(), m_slots.end(), order, [](double order, const Slot &slot)
+                             {
+                               return order < slot.order;
+                             });
+  return it - m_slots.begin();
+}
+
+/**
+ * @brief Page::renumberOrders replaces the order keys of all strokes, tombstones and dropped tombstones by 1, 2, 3, ... without changing their
+ * order.
+ */
+void Page::renumberOrders()
+{
+  QVector<QPair<double, StrokeId>> orders;
+  orders.reserve(m_orders.size());
+  QSet<StrokeId> slotIds;
+  slotIds.reserve(m_slots.size());
+  for (const Slot &slot : m_slots)
+  {
+    orders.append(qMakePair(slot.order, slot.id));
+    slotIds.insert(slot.id);
+  }
+  for (auto it = m_orders.constBegin(); it != m_orders.constEnd(); ++it)
+  {
+    if (!slotIds.contains(it.key()))
+    {
+      orders.append(qMakePair(it.value(), it.key()));
+    }
+  }
+  // stable, so equal keys keep the order of the slots
+  std::stable_sort(orders.begin(), orders.end(), [](const QPair<double, StrokeId> &a, const QPair<double, StrokeId> &b)
+                   {
+                     return a.first < b.first;
+                   });
+
+  for (int i = 0; i < orders.size(); ++i)
+  {
+    m_orders[orders.at(i).second] = i + 1;
+  }
+  for (Slot &slot : m_slots)
+  {
+    slot.order = m_orders.value(slot.id);
+  }
+  m_maxOrder = orders.size();
+}
+
+/**
+ * @brief Page::dropTombstones removes all tombstones from the stroke vector. Their strokes can still be restored, which then takes linear time.
+ * @return true if there were tombstones
+ */
+bool Page::dropTombstones()
+{
+  if (m_numTombstones == 0)
+  {
+    return false;
+  }
+
+  int j = 0;
+  for (int i = 0; i < m_slots.size(); ++i)
+  {
+    Slot slot = m_slots.at(i);
+    if (slot.removed)
+    {
+      // its order key stays in m_orders
+      continue;
+    }
+    if (i != j)
+    {
+      m_strokes[j] = m_strokes.at(i);
+      m_slots[j] = slot;
+    }
+    ++j;
+  }
+  m_strokes.resize(j);
+  m_slots.resize(j);
+  m_numTombstones = 0;
+  return true;
+}
+
+/**
+ * @brief Page::generation
+ * @return a number that changes whenever the page changes. Copies of a page have the same generation until one of them changes, and no two pages
+ * that differ ever get the same generation.
+ */
+quint64 Page::generation() const
+{
+  return m_generation;
+}
+
+void Page::touch()
+{
+  m_generation = lastGeneration.fetchAndAddRelaxed(1) + 1;
+}
+
+/**
+ * @brief Page::setLoader makes the page load its strokes lazily. The page should be empty, apart from its size and background.
+ * @param loader
+ */
+void Page::setLoader(const QSharedPointer<PageLoader> &loader)
+{
+  m_loader = loader;
+}
+
+bool Page::isLoaded() const
+{
+  return !m_loader;
+}
+
+/**
+ * @brief Page::load decodes the strokes of a lazily loaded page. Every function that touches the strokes calls this first, so it is only needed
+ * to decode pages ahead of time. Changes to the size and background made before are kept.
+ */
+void Page::load() const
+{
+  if (m_loader)
+  {
+    // the strokes are part of the logical state of the page, decoding them doesn't change it
+    const_cast<Page *>(this)->takeLoadedPage();
+  }
+}
+
+void Page::takeLoadedPage()
+{
+  QSharedPointer<PageLoader> loader = m_loader;
+  qreal width = m_width;
+  qreal height = m_height;
+  QColor backgroundColor = m_backgroundColor;
+  QRectF dirtyRect = m_dirtyRect;
+  quint64 generation = m_generation;
+
+  *this = loader->page();
+
+  m_width = width;
+  m_height = height;
+  m_backgroundColor = backgroundColor;
+  m_dirtyRect = dirtyRect;
+  m_generation = generation;
+  updateStrokeGrid();
+}
+
+/**
+ * @brief Page::reserve makes room for strokes with numPoints points in total in a single block of the arena, which is sized to fit them. Loaders
+ * that know how many points a page has call this first.
+ * @param numPoints
+ */
+void Page::reserve(int numPoints)
+{
+  m_arena.reserve(3 * numPoints);
+}
+
+/**
+ * @brief Page::compact drops the tombstones once they make up a quarter of the slots, and copies the data of all strokes into new arena blocks
+ * once the blocks they use are mostly garbage, which is left behind by removed and modified strokes. Blocks that are still referred to by undo
+ * commands or copies of the page stay alive until those are gone.
+ * @return true if anything changed
+ */
+bool Page::compact()
+{
+  if (m_loader)
+  {
+    return false; // nothing to compact before the strokes are decoded
+  }
+
+  bool compacted = false;
+  if (m_numTombstones > 0 && 4 * m_numTombstones >= m_strokes.size())
+  {
+    compacted = dropTombstones();
+  }
+
+  qint64 live = 0;
+  qint64 allocated = 0;
+  int needed = 0; // once the strokes are moved, which drops the room they had for appending points
+  QSet<const ArenaBlock *> blocks;
+  for (const Stroke &stroke : m_strokes)
+  {
+    live += stroke.dataSize();
+    needed += 3 * stroke.size();
+    const ArenaBlock *block = stroke.block();
+    if (block && !blocks.contains(block))
+    {
+      blocks.insert(block);
+      allocated += block->used();
+    }
+  }
+  // blocks grow from StrokeArena::minBlockSize to StrokeArena::blockSize, which takes seven blocks
+  if (allocated - live <= live / 2 && blocks.size() <= live / StrokeArena::blockSize + 8)
+  {
+    return compacted;
+  }
+
+  // one block that fits the strokes exactly
+  m_arena.reset();
+  m_arena.reserve(needed);
+  for (Stroke &stroke : m_strokes)
+  {
+    stroke.moveToArena(m_arena);
   }
+  return true;
 }
 }
@@ -2,10 +2,30 @@
 #define PAGE_H
 
 #include "stroke.h"
+#include "strokegrid.h"
+
+#include <QHash>
+#include <QSharedPointer>
 
 namespace MrDoc
 {
 
+class PageLoader;
+
+/**
+ * @brief The Page class holds the strokes of a page in the order they are painted.
+ * @details Every stroke gets an id when it is added, which stays the same while the stroke is on the page, so undo commands refer to strokes by
+ * id. Removing a stroke leaves an empty tombstone in its slot, which keeps the slots of all other strokes, and restoring the stroke later puts it
+ * back into its tombstone, both without touching any other stroke. compact() drops the tombstones once there are many of them; a stroke whose
+ * tombstone is gone is put back at the position given by its order key, which every stroke gets when it is added. The order keys increase with
+ * the slots, so the slot of an id is found with a binary search and inserting a stroke doesn't renumber anything but the slots behind it.
+ *
+ * Every change gives the page a new generation(), by which the document tells the pages that have to be saved from those that don't.
+ *
+ * A page that is loaded lazily only knows its size and background at first. Its strokes are decoded by its PageLoader when they are first
+ * needed, see load(). Since that changes the page even through const functions, a Page object must not be used on two threads at once; copies
+ * of it can.
+ */
 class Page
 {
 public:
@@ -27,19 +47,34 @@ public:
   bool changeStrokeColor(int strokeNum, QColor color);
   bool changeStrokePattern(int strokeNum, QVector<qreal> pattern);
 
-  const QVector<Stroke> &strokes();
+  const QVector<Stroke> &strokes() const;
+  QVector<int> strokesIntersecting(const QRectF &rect) const;
+  StrokeId strokeId(int strokeNum) const;
+  int strokeNum(StrokeId id) const;
+
+  QVector<QPair<Stroke, StrokeId>> getStrokes(QPolygonF selectionPolygon);
+  QVector<QPair<Stroke, StrokeId>> removeStrokes(QPolygonF selectionPolygon);
+  void removeStroke(StrokeId id);
+  void removeStrokes(const QVector<StrokeId> &ids);
+
+  void restoreStroke(StrokeId id, const Stroke &stroke);
+  void restoreStrokes(const QVector<QPair<Stroke, StrokeId>> &strokesAndIds);
+  void restoreStrokes(const QVector<Stroke> &strokes, const QVector<StrokeId> &ids);
 
-  QVector<QPair<Stroke, int>> getStrokes(QPolygonF selectionPolygon);
-  QVector<QPair<Stroke, int>> removeStrokes(QPolygonF selectionPolygon);
-  void removeStrokeAt(int i);
-  void removeLastStroke();
+  StrokeId appendStroke(const Stroke &stroke);
+  StrokeId appendStroke(const float *xs, const float *ys, const float *pressures, int numPoints, int style, qreal penWidth);
+  QVector<StrokeId> appendStrokes(const QVector<Stroke> &strokes);
+  StrokeId prependStroke(const Stroke &stroke);
+  StrokeId insertStrokeAfter(StrokeId id, const Stroke &stroke);
 
-  void insertStrokes(const QVector<QPair<Stroke, int>> &strokesAndPositions);
-  void insertStroke(int position, const Stroke &stroke);
+  void reserve(int numPoints);
+  bool compact();
 
-  void appendStroke(const Stroke &stroke);
-  void appendStrokes(const QVector<Stroke> &strokes);
-  void prependStroke(const Stroke &stroke);
+  quint64 generation() const;
+
+  void setLoader(const QSharedPointer<PageLoader> &loader);
+  bool isLoaded() const;
+  void load() const;
 
   //    virtual void paint(QPainter &painter, qreal zoom);
   /**
@@ -48,20 +83,52 @@ public:
    * @param zoom
    * @param region
    */
-  virtual void paint(QPainter &painter, qreal zoom, QRectF region = QRect(0, 0, 0, 0));
+  virtual void paint(QPainter &painter, qreal zoom, QRectF region = QRect(0, 0, 0, 0)) const;
 
   //    QVector<Stroke> strokes;
 
 protected:
-  QVector<Stroke> m_strokes;
+  void updateStrokeGrid();
+
+  QVector<Stroke> m_strokes; // in paint order, removed strokes leave an empty tombstone until the page is compacted
 
 private:
   QColor m_backgroundColor;
 
-  qreal m_width;  // post script units
-  qreal m_height; // post script units
+  qreal m_width = 0.0;  // post script units
+  qreal m_height = 0.0; // post script units
 
   QRectF m_dirtyRect;
+
+  quint64 m_generation = 0; // see generation()
+  void touch();
+
+  QSharedPointer<PageLoader> m_loader; // decodes the strokes of a lazily loaded page, null once they are there
+  void takeLoadedPage();
+
+  struct Slot
+  {
+    StrokeId id;
+    double order;  // increases with the slot number, restored strokes are put back by it
+    bool removed;  // the slot is a tombstone
+  };
+
+  int slotOf(StrokeId id) const;
+  QVector<int> strokeNums(const QVector<StrokeId> &ids) const;
+  StrokeId insertSlot(int strokeNum, StrokeId id, double order, const Stroke &stroke, bool inArena = false);
+  double orderAt(int strokeNum);
+  int slotForOrder(double order) const;
+  void renumberOrders();
+  bool dropTombstones();
+
+  StrokeGrid m_strokeGrid;
+  StrokeArena m_arena; // holds the point data of the strokes
+
+  QVector<Slot> m_slots;            // one for every element of m_strokes
+  QHash<StrokeId, double> m_orders; // order key of every stroke and tombstone, also of the tombstones that were dropped
+  StrokeId m_lastId = 0;
+  double m_maxOrder = 0.0;
+  int m_numTombstones = 0;
 };
 }
 
@@ -0,0 +1,975 @@
+#include "pagecache.h"
+
+#include <QPainter>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+constexpr int PageCache::tileSize;
+constexpr qreal PageCache::mipmapZoom;
+constexpr int PageCache::numMipmapLevels;
+
+PageCache::PageCache(QObject *parent) : QObject(parent)
+{
+  m_budget = 512 * 1024 * 1024;
+}
+
+PageCache::~PageCache()
+{
+  // results of running renders are posted to this object
+  m_threadPool.waitForDone();
+}
+
+void PageCache::setBudget(qint64 budget)
+{
+  m_budget = budget;
+  evict();
+}
+
+qint64 PageCache::budget() const
+{
+  return m_budget;
+}
+
+qint64 PageCache::usedMemory() const
+{
+  return m_usedMemory;
+}
+
+/**
+ * @brief PageCache::setZoom sets the zoom the tiles are rendered at. All tiles are dropped, but with progressive zoom enabled either they or the
+ * current preview are kept as the new preview, whichever covers more of the document.
+ * @param zoom
+ * @param devicePixelRatio
+ */
+void PageCache::setZoom(qreal zoom, int devicePixelRatio)
+{
+  m_generation.ref();
+
+  if (!m_progressiveZoom)
+  {
+    m_previewPages.clear();
+  }
+  else if (coverage(m_pages, m_zoom, m_devicePixelRatio) >= coverage(m_previewPages, m_previewZoom, m_previewDevicePixelRatio))
+  {
+    m_previewPages = m_pages;
+    m_previewZoom = m_zoom;
+    m_previewDevicePixelRatio = m_devicePixelRatio;
+  }
+  m_previewPages.resize(m_pages.size());
+
+  m_usedMemory = 0;
+  for (int i = 0; i < m_pages.size(); ++i)
+  {
+    // mipmaps don't depend on the zoom
+    if (devicePixelRatio != m_devicePixelRatio)
+    {
+      m_mipmaps[i] = Mipmap();
+    }
+    for (const QImage &image : m_mipmaps[i].levels)
+    {
+      m_usedMemory += imageSize(image);
+    }
+
+    m_pages[i].clear();
+    QHash<int, Tile> &tiles = m_previewPages[i];
+    for (auto it = tiles.begin(); it != tiles.end();)
+    {
+      if (it->pixmap.isNull())
+      {
+        it = tiles.erase(it);
+      }
+      else
+      {
+        m_usedMemory += pixmapSize(it->pixmap);
+        ++it;
+      }
+    }
+  }
+
+  m_zoom = zoom;
+  m_devicePixelRatio = devicePixelRatio;
+}
+
+void PageCache::setProgressiveZoom(bool progressiveZoom)
+{
+  m_progressiveZoom = progressiveZoom;
+  if (!m_progressiveZoom)
+  {
+    for (int i = 0; i < m_previewPages.size(); ++i)
+    {
+      for (const Tile &tile : m_previewPages[i])
+      {
+        m_usedMemory -= pixmapSize(tile.pixmap);
+      }
+      m_previewPages[i].clear();
+    }
+  }
+}
+
+bool PageCache::progressiveZoom() const
+{
+  return m_progressiveZoom;
+}
+
+int PageCache::size() const
+{
+  return m_pages.size();
+}
+
+void PageCache::resize(int numPages)
+{
+  for (int i = numPages; i < m_pages.size(); ++i)
+  {
+    invalidatePage(i);
+  }
+  m_pages.resize(numPages);
+  m_previewPages.resize(numPages);
+  m_mipmaps.resize(numPages);
+}
+
+void PageCache::insertPage(int pageNum)
+{
+  m_pages.insert(pageNum, QHash<int, Tile>());
+  m_previewPages.insert(pageNum, QHash<int, Tile>());
+  m_mipmaps.insert(pageNum, Mipmap());
+  for (int i = pageNum + 1; i < m_pages.size(); ++i)
+  {
+    dropPending(i);
+  }
+}
+
+void PageCache::removePage(int pageNum)
+{
+  invalidatePage(pageNum);
+  m_pages.removeAt(pageNum);
+  m_previewPages.removeAt(pageNum);
+  m_mipmaps.removeAt(pageNum);
+  for (int i = pageNum; i < m_pages.size(); ++i)
+  {
+    dropPending(i);
+  }
+}
+
+/**
+ * @brief PageCache::invalidatePage drops all tiles of a page, e.g. because its size changed.
+ * @param pageNum
+ */
+void PageCache::invalidatePage(int pageNum)
+{
+  for (const Tile &tile : m_pages[pageNum])
+  {
+    m_usedMemory -= pixmapSize(tile.pixmap);
+  }
+  for (const Tile &tile : m_previewPages[pageNum])
+  {
+    m_usedMemory -= pixmapSize(tile.pixmap);
+  }
+  m_pages[pageNum].clear();
+  m_previewPages[pageNum].clear();
+  clearMipmap(pageNum);
+}
+
+void PageCache::clear()
+{
+  for (int i = 0; i < m_pages.size(); ++i)
+  {
+    m_pages[i].clear();
+    m_previewPages[i].clear();
+    m_mipmaps[i] = Mipmap();
+  }
+  m_usedMemory = 0;
+}
+
+/**
+ * @brief PageCache::beginFrame has to be called at the beginning of every paint event. Tiles that are used within the frame are not evicted.
+ */
+void PageCache::beginFrame()
+{
+  ++m_clock;
+}
+
+/**
+ * @brief PageCache::request starts rendering the tiles of a page that intersect rect in the background, unless they are rendered or on their way.
+ * @param pageNum
+ * @param page is copied, so the document can be changed while the tiles are rendered. Changes are not part of the result though, so
+ * updateRegion() has to be called for regions that are modified before tileReady() arrives.
+ * @param rect
+ */
+void PageCache::request(int pageNum, const MrDoc::Page &page, const QRectF &rect)
+{
+  if (useMipmaps())
+  {
+    if (pageRect(page).intersects(rect))
+    {
+      requestMipmap(pageNum, page, false);
+    }
+    return;
+  }
+
+  int firstColumn, lastColumn, firstRow, lastRow;
+  if (!tileRange(page, rect, firstColumn, lastColumn, firstRow, lastRow))
+  {
+    return;
+  }
+
+  QHash<int, Tile> &tiles = m_pages[pageNum];
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      int key = tileKey(column, row);
+      Tile &tile = tiles[key];
+      tile.lastUsed = m_clock;
+      if (!tile.pixmap.isNull() || tile.request != 0)
+      {
+        continue;
+      }
+
+      int request = nextRequest();
+      tile.request = request;
+
+      qreal zoom = m_zoom;
+      int devicePixelRatio = m_devicePixelRatio;
+      int generation = m_generation.load();
+      QtConcurrent::run(&m_threadPool, [this, pageNum, key, request, page, zoom, devicePixelRatio, generation]()
+                        {
+                          if (m_generation.load() != generation)
+                          {
+                            // the zoom changed while the render was queued
+                            return;
+                          }
+                          QImage image = renderTile(page, tileColumn(key), tileRow(key), zoom, devicePixelRatio);
+                          QMetaObject::invokeMethod(this, "imageReady", Qt::QueuedConnection, Q_ARG(int, pageNum), Q_ARG(int, key), Q_ARG(int, request),
+                                                    Q_ARG(QImage, image));
+                        });
+    }
+  }
+}
+
+/**
+ * @brief PageCache::render renders the missing tiles of a page that intersect rect right away.
+ * @param pageNum
+ * @param page
+ * @param rect
+ */
+void PageCache::render(int pageNum, const MrDoc::Page &page, const QRectF &rect)
+{
+  if (useMipmaps())
+  {
+    if (pageRect(page).intersects(rect))
+    {
+      requestMipmap(pageNum, page, true);
+    }
+    return;
+  }
+
+  int firstColumn, lastColumn, firstRow, lastRow;
+  if (!tileRange(page, rect, firstColumn, lastColumn, firstRow, lastRow))
+  {
+    return;
+  }
+
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      int key = tileKey(column, row);
+      if (m_pages[pageNum].value(key).pixmap.isNull())
+      {
+        storeTile(pageNum, key, QPixmap::fromImage(renderTile(page, column, row, m_zoom, m_devicePixelRatio)));
+      }
+    }
+  }
+}
+
+/**
+ * @brief PageCache::paint draws the tiles or the mipmap of a page that intersect rect. Tiles that aren't rendered yet are drawn in the background
+ * color of the page, covered by a mipmap or the preview where there is one.
+ * @param painter has to be translated to the top left corner of the page.
+ * @param pageNum
+ * @param page
+ * @param rect
+ */
+void PageCache::paint(QPainter &painter, int pageNum, const MrDoc::Page &page, const QRectF &rect)
+{
+  if (useMipmaps())
+  {
+    QRectF rectPage = pageRect(page);
+    if (!paintMipmap(painter, pageNum, rectPage, rect))
+    {
+      QRectF placeholderRect = rectPage.intersected(rect);
+      painter.fillRect(placeholderRect, page.backgroundColor());
+      paintPreview(painter, pageNum, page, placeholderRect);
+    }
+    return;
+  }
+
+  int firstColumn, lastColumn, firstRow, lastRow;
+  if (!tileRange(page, rect, firstColumn, lastColumn, firstRow, lastRow))
+  {
+    return;
+  }
+
+  QHash<int, Tile> &tiles = m_pages[pageNum];
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      int key = tileKey(column, row);
+      auto it = tiles.find(key);
+      if (it != tiles.end() && !it->pixmap.isNull())
+      {
+        it->lastUsed = m_clock;
+        QRectF rectTarget(tileRect(key).topLeft(), QSizeF(it->pixmap.size()) / m_devicePixelRatio);
+        painter.drawPixmap(rectTarget, it->pixmap, QRectF(it->pixmap.rect()));
+      }
+      else
+      {
+        // placeholder until the tile is ready
+        QRectF rectPage = pageRect(page);
+        QRectF placeholderRect = tileRect(key).intersected(rectPage);
+        painter.fillRect(placeholderRect, page.backgroundColor());
+        paintMipmap(painter, pageNum, rectPage, placeholderRect);
+        paintPreview(painter, pageNum, page, placeholderRect);
+      }
+    }
+  }
+}
+
+/**
+ * @brief PageCache::paintPreview draws the part of the preview of a page that covers rect, scaled to the current zoom.
+ * @param painter
+ * @param pageNum
+ * @param page
+ * @param rect is in logical pixels at the current zoom
+ */
+void PageCache::paintPreview(QPainter &painter, int pageNum, const MrDoc::Page &page, const QRectF &rect)
+{
+  QHash<int, Tile> &tiles = m_previewPages[pageNum];
+  if (tiles.isEmpty())
+  {
+    return;
+  }
+
+  qreal scale = m_zoom / m_previewZoom;
+  QRectF previewRect(rect.topLeft() / scale, rect.bottomRight() / scale);
+  int firstColumn, lastColumn, firstRow, lastRow;
+  if (!tileRange(page, previewRect, m_previewZoom, m_previewDevicePixelRatio, firstColumn, lastColumn, firstRow, lastRow))
+  {
+    return;
+  }
+
+  painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      int key = tileKey(column, row);
+      auto it = tiles.find(key);
+      if (it == tiles.end())
+      {
+        continue;
+      }
+      it->lastUsed = m_clock;
+
+      QRectF previewTileRect(tileRect(key, m_previewDevicePixelRatio).topLeft(), QSizeF(it->pixmap.size()) / m_previewDevicePixelRatio);
+      QRectF sourceRect = previewTileRect.intersected(previewRect);
+      if (sourceRect.isEmpty())
+      {
+        continue;
+      }
+      QRectF targetRect(sourceRect.topLeft() * scale, sourceRect.bottomRight() * scale);
+      sourceRect.translate(-previewTileRect.topLeft());
+      sourceRect = QRectF(sourceRect.topLeft() * m_previewDevicePixelRatio, sourceRect.size() * m_previewDevicePixelRatio);
+      painter.drawPixmap(targetRect, it->pixmap, sourceRect);
+    }
+  }
+}
+
+bool PageCache::useMipmaps() const
+{
+  return m_zoom <= mipmapZoom;
+}
+
+/**
+ * @brief PageCache::mipmapLevel
+ * @return the coarsest mipmap level that is at least as fine as the zoom
+ */
+int PageCache::mipmapLevel() const
+{
+  int level = qFloor(std::log2(1.0 / m_zoom));
+  return qBound(1, level, numMipmapLevels - 1);
+}
+
+/**
+ * @brief PageCache::pageRect
+ * @return the rect of the page at the current zoom, rounded to device pixels the same way as the tiles
+ */
+QRectF PageCache::pageRect(const MrDoc::Page &page) const
+{
+  int pixelWidth = m_zoom * page.width() * m_devicePixelRatio;
+  int pixelHeight = m_zoom * page.height() * m_devicePixelRatio;
+  return QRectF(0.0, 0.0, pixelWidth / static_cast<qreal>(m_devicePixelRatio), pixelHeight / static_cast<qreal>(m_devicePixelRatio));
+}
+
+/**
+ * @brief PageCache::requestMipmap makes sure the mipmap level for the current zoom is available. If a finer level is cached, it is downsampled,
+ * otherwise the page is rendered.
+ * @param pageNum
+ * @param page
+ * @param synchronous render right away instead of in the background
+ */
+void PageCache::requestMipmap(int pageNum, const MrDoc::Page &page, bool synchronous)
+{
+  Mipmap &mipmap = m_mipmaps[pageNum];
+  mipmap.lastUsed = m_clock;
+
+  int level = mipmapLevel();
+  if (!mipmap.levels.value(level).isNull() || downsampleMipmap(pageNum, page, level))
+  {
+    return;
+  }
+
+  if (synchronous)
+  {
+    storeMipmap(pageNum, level, renderMipmap(page, level, m_devicePixelRatio));
+    return;
+  }
+  if (mipmap.request != 0)
+  {
+    return;
+  }
+
+  int request = nextRequest();
+  mipmap.request = request;
+
+  int devicePixelRatio = m_devicePixelRatio;
+  QtConcurrent::run(&m_threadPool, [this, pageNum, level, request, page, devicePixelRatio]()
+                    {
+                      QImage image = renderMipmap(page, level, devicePixelRatio);
+                      QMetaObject::invokeMethod(this, "mipmapReady", Qt::QueuedConnection, Q_ARG(int, pageNum), Q_ARG(int, level), Q_ARG(int, request),
+                                                Q_ARG(QImage, image));
+                    });
+}
+
+/**
+ * @brief PageCache::downsampleMipmap generates a mipmap level by halving the closest finer level that is cached, as often as needed.
+ * @return false if there is no finer level
+ */
+bool PageCache::downsampleMipmap(int pageNum, const MrDoc::Page &page, int level)
+{
+  const QVector<QImage> &levels = m_mipmaps[pageNum].levels;
+  int finerLevel = level - 1;
+  while (finerLevel >= 0 && levels.value(finerLevel).isNull())
+  {
+    --finerLevel;
+  }
+  if (finerLevel < 0)
+  {
+    return false;
+  }
+
+  for (int i = finerLevel + 1; i <= level; ++i)
+  {
+    qreal zoom = 1.0 / (1 << i);
+    int pixelWidth = qMax(1, static_cast<int>(zoom * page.width() * m_devicePixelRatio));
+    int pixelHeight = qMax(1, static_cast<int>(zoom * page.height() * m_devicePixelRatio));
+    QImage image = m_mipmaps[pageNum].levels.at(i - 1).scaled(pixelWidth, pixelHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    image.setDevicePixelRatio(m_devicePixelRatio);
+    storeMipmap(pageNum, i, image);
+  }
+  return true;
+}
+
+/**
+ * @brief PageCache::paintMipmap draws the part of the mipmap of a page that covers rect, preferring the level for the current zoom, then finer
+ * and then coarser levels.
+ * @param painter
+ * @param pageNum
+ * @param pageRect is the rect of the page at the current zoom
+ * @param rect
+ * @return false if no level is cached
+ */
+bool PageCache::paintMipmap(QPainter &painter, int pageNum, const QRectF &pageRect, const QRectF &rect)
+{
+  Mipmap &mipmap = m_mipmaps[pageNum];
+  if (mipmap.levels.isEmpty())
+  {
+    return false;
+  }
+
+  int level = mipmapLevel();
+  const QImage *image = nullptr;
+  for (int i = level; i >= 0 && image == nullptr; --i)
+  {
+    if (!mipmap.levels.at(i).isNull())
+    {
+      image = &mipmap.levels.at(i);
+    }
+  }
+  for (int i = level + 1; i < numMipmapLevels && image == nullptr; ++i)
+  {
+    if (!mipmap.levels.at(i).isNull())
+    {
+      image = &mipmap.levels.at(i);
+    }
+  }
+  if (image == nullptr)
+  {
+    return false;
+  }
+  mipmap.lastUsed = m_clock;
+
+  QRectF targetRect = pageRect.intersected(rect);
+  if (targetRect.isEmpty())
+  {
+    return true;
+  }
+  qreal scaleX = image->width() / pageRect.width();
+  qreal scaleY = image->height() / pageRect.height();
+  QRectF sourceRect(targetRect.left() * scaleX, targetRect.top() * scaleY, targetRect.width() * scaleX, targetRect.height() * scaleY);
+
+  painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+  painter.drawImage(targetRect, *image, sourceRect);
+  return true;
+}
+
+/**
+ * @brief PageCache::finestMipmapLevel
+ * @return the finest mipmap level of a page that is cached, -1 if there is none
+ */
+int PageCache::finestMipmapLevel(int pageNum) const
+{
+  const QVector<QImage> &levels = m_mipmaps.at(pageNum).levels;
+  for (int i = 0; i < levels.size(); ++i)
+  {
+    if (!levels.at(i).isNull())
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void PageCache::storeMipmap(int pageNum, int level, const QImage &image)
+{
+  Mipmap &mipmap = m_mipmaps[pageNum];
+  if (mipmap.levels.isEmpty())
+  {
+    mipmap.levels.resize(numMipmapLevels);
+  }
+  m_usedMemory -= imageSize(mipmap.levels.at(level));
+  mipmap.levels[level] = image;
+  mipmap.lastUsed = m_clock;
+  m_usedMemory += imageSize(image);
+  evict();
+}
+
+/**
+ * @brief PageCache::clearMipmap drops the mipmap levels of a page and discards its pending render.
+ * @param pageNum
+ * @param keepLevel is not dropped
+ */
+void PageCache::clearMipmap(int pageNum, int keepLevel)
+{
+  Mipmap &mipmap = m_mipmaps[pageNum];
+  for (int i = 0; i < mipmap.levels.size(); ++i)
+  {
+    if (i != keepLevel)
+    {
+      m_usedMemory -= imageSize(mipmap.levels.at(i));
+      mipmap.levels[i] = QImage();
+    }
+  }
+  mipmap.request = 0;
+}
+
+/**
+ * @brief PageCache::updateRegion repaints rect on all tiles of the page that are affected. Renders of affected tiles that are still running are
+ * dropped, since they don't know about the change.
+ * @param pageNum
+ * @param page
+ * @param rect
+ */
+void PageCache::updateRegion(int pageNum, const MrDoc::Page &page, const QRectF &rect)
+{
+  // the preview would show the region as it was before
+  QHash<int, Tile> &previewTiles = m_previewPages[pageNum];
+  qreal scale = m_zoom / m_previewZoom;
+  QRectF previewRect(rect.topLeft() / scale, rect.bottomRight() / scale);
+  for (auto it = previewTiles.begin(); it != previewTiles.end();)
+  {
+    if (tileRect(it.key(), m_previewDevicePixelRatio).intersects(previewRect))
+    {
+      m_usedMemory -= pixmapSize(it->pixmap);
+      it = previewTiles.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  // only the finest mipmap level is repainted, coarser ones are downsampled again when needed
+  QVector<QImage> &levels = m_mipmaps[pageNum].levels;
+  int finestLevel = finestMipmapLevel(pageNum);
+  clearMipmap(pageNum, finestLevel);
+  if (finestLevel >= 0)
+  {
+    qreal levelZoom = 1.0 / (1 << finestLevel);
+    QRectF pageClipRect(rect.topLeft() / m_zoom, rect.bottomRight() / m_zoom);
+    QRectF levelClipRect(pageClipRect.topLeft() * levelZoom, pageClipRect.bottomRight() * levelZoom);
+
+    QPainter painter;
+    painter.begin(&levels[finestLevel]);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setClipRect(levelClipRect);
+    painter.setClipping(true);
+
+    painter.fillRect(levelClipRect, page.backgroundColor());
+    page.paint(painter, levelZoom, pageClipRect);
+
+    painter.end();
+  }
+
+  QHash<int, Tile> &tiles = m_pages[pageNum];
+  for (auto it = tiles.begin(); it != tiles.end();)
+  {
+    QRectF tileClipRect = tileRect(it.key()).intersected(rect);
+    if (tileClipRect.isEmpty())
+    {
+      ++it;
+      continue;
+    }
+    if (it->pixmap.isNull())
+    {
+      it = tiles.erase(it);
+      continue;
+    }
+
+    QPainter painter;
+    painter.begin(&it->pixmap);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.translate(-tileRect(it.key()).topLeft());
+    painter.setClipRect(tileClipRect);
+    painter.setClipping(true);
+
+    painter.fillRect(tileClipRect, page.backgroundColor());
+
+    QRectF paintRect = QRectF(tileClipRect.topLeft() / m_zoom, tileClipRect.bottomRight() / m_zoom);
+    page.paint(painter, m_zoom, paintRect);
+
+    painter.end();
+    ++it;
+  }
+}
+
+/**
+ * @brief PageCache::paintStroke draws a stroke that is not yet part of the page directly onto the tiles it touches.
+ * @param pageNum
+ * @param stroke
+ * @param last only draw the last segment of the stroke
+ */
+void PageCache::paintStroke(int pageNum, const MrDoc::Stroke &stroke, bool last)
+{
+  QRectF strokeRect;
+  if (last && stroke.size() > 1)
+  {
+    int n = stroke.size();
+    qreal pad = stroke.penWidth() * qMax(stroke.pressure(n - 2), stroke.pressure(n - 1));
+    strokeRect = QRectF(stroke.point(n - 2), stroke.point(n - 1)).normalized().adjusted(-pad, -pad, pad, pad);
+  }
+  else
+  {
+    strokeRect = stroke.boundingRect();
+  }
+
+  QVector<QImage> &levels = m_mipmaps[pageNum].levels;
+  int finestLevel = finestMipmapLevel(pageNum);
+  clearMipmap(pageNum, finestLevel);
+  if (finestLevel >= 0)
+  {
+    QPainter painter;
+    painter.begin(&levels[finestLevel]);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+
+    stroke.paint(painter, 1.0 / (1 << finestLevel), last);
+  }
+
+  strokeRect = QRectF(strokeRect.topLeft() * m_zoom, strokeRect.bottomRight() * m_zoom);
+
+  QHash<int, Tile> &tiles = m_pages[pageNum];
+  for (auto it = tiles.begin(); it != tiles.end(); ++it)
+  {
+    if (it->pixmap.isNull() || !tileRect(it.key()).intersects(strokeRect))
+    {
+      continue;
+    }
+    QPainter painter;
+    painter.begin(&it->pixmap);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.translate(-tileRect(it.key()).topLeft());
+
+    stroke.paint(painter, m_zoom, last);
+  }
+}
+
+QImage PageCache::renderTile(const MrDoc::Page &page, int column, int row, qreal zoom, int devicePixelRatio)
+{
+  int pixelWidth = zoom * page.width() * devicePixelRatio;
+  int pixelHeight = zoom * page.height() * devicePixelRatio;
+  int x = column * tileSize;
+  int y = row * tileSize;
+  QImage image(qMin(tileSize, pixelWidth - x), qMin(tileSize, pixelHeight - y), QImage::Format_ARGB32_Premultiplied);
+  image.setDevicePixelRatio(devicePixelRatio);
+
+  image.fill(page.backgroundColor());
+
+  QPainter painter;
+  painter.begin(&image);
+  painter.setRenderHint(QPainter::Antialiasing, true);
+
+  QRectF rect = QRectF(x, y, image.width(), image.height());
+  rect = QRectF(rect.topLeft() / devicePixelRatio, rect.size() / devicePixelRatio);
+  painter.translate(-rect.topLeft());
+  page.paint(painter, zoom, QRectF(rect.topLeft() / zoom, rect.bottomRight() / zoom));
+
+  painter.end();
+
+  return image;
+}
+
+QImage PageCache::renderMipmap(const MrDoc::Page &page, int level, int devicePixelRatio)
+{
+  qreal zoom = 1.0 / (1 << level);
+  int pixelWidth = qMax(1, static_cast<int>(zoom * page.width() * devicePixelRatio));
+  int pixelHeight = qMax(1, static_cast<int>(zoom * page.height() * devicePixelRatio));
+  QImage image(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
+  image.setDevicePixelRatio(devicePixelRatio);
+
+  image.fill(page.backgroundColor());
+
+  QPainter painter;
+  painter.begin(&image);
+  painter.setRenderHint(QPainter::Antialiasing, true);
+
+  page.paint(painter, zoom);
+
+  painter.end();
+
+  return image;
+}
+
+void PageCache::imageReady(int pageNum, int key, int request, QImage image)
+{
+  if (pageNum >= m_pages.size() || m_pages[pageNum].value(key).request != request)
+  {
+    // the tile was changed, moved or dropped in the meantime
+    return;
+  }
+  storeTile(pageNum, key, QPixmap::fromImage(image));
+  emit tileReady(pageNum, tileRect(key));
+}
+
+void PageCache::mipmapReady(int pageNum, int level, int request, QImage image)
+{
+  if (pageNum >= m_mipmaps.size() || m_mipmaps[pageNum].request != request)
+  {
+    return;
+  }
+  m_mipmaps[pageNum].request = 0;
+  storeMipmap(pageNum, level, image);
+
+  qreal scale = m_zoom * (1 << level) / m_devicePixelRatio;
+  emit tileReady(pageNum, QRectF(0.0, 0.0, image.width() * scale, image.height() * scale).adjusted(-1.0, -1.0, 1.0, 1.0));
+}
+
+int PageCache::tileKey(int column, int row)
+{
+  return (row << 16) | column;
+}
+
+int PageCache::tileColumn(int key)
+{
+  return key & 0xffff;
+}
+
+int PageCache::tileRow(int key)
+{
+  return key >> 16;
+}
+
+QRectF PageCache::tileRect(int key, int devicePixelRatio)
+{
+  qreal logicalTileSize = tileSize / static_cast<qreal>(devicePixelRatio);
+  return QRectF(tileColumn(key) * logicalTileSize, tileRow(key) * logicalTileSize, logicalTileSize, logicalTileSize);
+}
+
+QRectF PageCache::tileRect(int key) const
+{
+  return tileRect(key, m_devicePixelRatio);
+}
+
+/**
+ * @brief PageCache::tileRange computes the columns and rows of the tiles of a page rendered at zoom that intersect rect.
+ * @return false if no tile intersects rect
+ */
+bool PageCache::tileRange(const MrDoc::Page &page, const QRectF &rect, qreal zoom, int devicePixelRatio, int &firstColumn, int &lastColumn,
+                          int &firstRow, int &lastRow)
+{
+  int pixelWidth = zoom * page.width() * devicePixelRatio;
+  int pixelHeight = zoom * page.height() * devicePixelRatio;
+  if (pixelWidth <= 0 || pixelHeight <= 0 || rect.isEmpty())
+  {
+    return false;
+  }
+  int numColumns = (pixelWidth + tileSize - 1) / tileSize;
+  int numRows = (pixelHeight + tileSize - 1) / tileSize;
+
+  firstColumn = qMax(0, qFloor(rect.left() * devicePixelRatio / tileSize));
+  lastColumn = qMin(numColumns - 1, qFloor(rect.right() * devicePixelRatio / tileSize));
+  firstRow = qMax(0, qFloor(rect.top() * devicePixelRatio / tileSize));
+  lastRow = qMin(numRows - 1, qFloor(rect.bottom() * devicePixelRatio / tileSize));
+
+  return firstColumn <= lastColumn && firstRow <= lastRow;
+}
+
+bool PageCache::tileRange(const MrDoc::Page &page, const QRectF &rect, int &firstColumn, int &lastColumn, int &firstRow, int &lastRow) const
+{
+  return tileRange(page, rect, m_zoom, m_devicePixelRatio, firstColumn, lastColumn, firstRow, lastRow);
+}
+
+/**
+ * @brief PageCache::coverage computes the area of the document in points² that is covered by rendered tiles.
+ */
+qreal PageCache::coverage(const QVector<QHash<int, Tile>> &pages, qreal zoom, int devicePixelRatio) const
+{
+  qreal pixels = 0.0;
+  for (const QHash<int, Tile> &tiles : pages)
+  {
+    for (const Tile &tile : tiles)
+    {
+      pixels += static_cast<qreal>(tile.pixmap.width()) * tile.pixmap.height();
+    }
+  }
+  qreal pixelsPerPoint = zoom * devicePixelRatio;
+  return pixels / (pixelsPerPoint * pixelsPerPoint);
+}
+
+int PageCache::nextRequest()
+{
+  if (++m_lastRequest <= 0)
+  {
+    m_lastRequest = 1;
+  }
+  return m_lastRequest;
+}
+
+void PageCache::storeTile(int pageNum, int key, const QPixmap &pixmap)
+{
+  Tile &tile = m_pages[pageNum][key];
+  m_usedMemory -= pixmapSize(tile.pixmap);
+  tile.pixmap = pixmap;
+  tile.request = 0;
+  tile.lastUsed = m_clock;
+  m_usedMemory += pixmapSize(tile.pixmap);
+  evict();
+}
+
+void PageCache::dropPending(int pageNum)
+{
+  // pending renders still carry their old page number
+  m_mipmaps[pageNum].request = 0;
+  QHash<int, Tile> &tiles = m_pages[pageNum];
+  for (auto it = tiles.begin(); it != tiles.end();)
+  {
+    if (it->pixmap.isNull())
+    {
+      it = tiles.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void PageCache::evict()
+{
+  if (m_usedMemory <= m_budget)
+  {
+    return;
+  }
+
+  struct Candidate
+  {
+    bool preview;
+    bool mipmap;
+    quint64 lastUsed;
+    int pageNum;
+    int key;
+  };
+
+  QVector<Candidate> candidates;
+  for (int i = 0; i < m_pages.size(); ++i)
+  {
+    for (auto it = m_pages[i].constBegin(); it != m_pages[i].constEnd(); ++it)
+    {
+      // tiles used in the current frame are on screen
+      if (!it->pixmap.isNull() && it->lastUsed < m_clock)
+      {
+        candidates.append({false, false, it->lastUsed, i, it.key()});
+      }
+    }
+    for (auto it = m_previewPages[i].constBegin(); it != m_previewPages[i].constEnd(); ++it)
+    {
+      if (it->lastUsed < m_clock)
+      {
+        candidates.append({true, false, it->lastUsed, i, it.key()});
+      }
+    }
+    if (!m_mipmaps[i].levels.isEmpty() && m_mipmaps[i].lastUsed < m_clock)
+    {
+      candidates.append({false, true, m_mipmaps[i].lastUsed, i, 0});
+    }
+  }
+  // preview tiles go first, they are only a stand-in
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+            {
+              if (a.preview != b.preview)
+              {
+                return a.preview;
+              }
+              return a.lastUsed < b.lastUsed;
+            });
+
+  for (const Candidate &candidate : candidates)
+  {
+    if (m_usedMemory <= m_budget)
+    {
+      break;
+    }
+    if (candidate.mipmap)
+    {
+      clearMipmap(candidate.pageNum);
+      m_mipmaps[candidate.pageNum].levels.clear();
+      continue;
+    }
+    QHash<int, Tile> &tiles = candidate.preview ? m_previewPages[candidate.pageNum] : m_pages[candidate.pageNum];
+    m_usedMemory -= pixmapSize(tiles.value(candidate.key).pixmap);
+    tiles.remove(candidate.key);
+  }
+}
+
+qint64 PageCache::pixmapSize(const QPixmap &pixmap)
+{
+  return static_cast<qint64>(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+}
+
+qint64 PageCache::imageSize(const QImage &image)
+{
+  return static_cast<qint64>(image.width()) * image.height() * image.depth() / 8;
+}
@@ -0,0 +1,136 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QPixmap>
+#include <QImage>
+#include <QHash>
+#include <QThreadPool>
+#include <QVector>
+
+#include "page.h"
+
+/**
+ * @brief The PageCache class holds the rendered page buffers of the Widget.
+ * @details Every page is split into tiles of tileSize x tileSize device pixels, which are rendered, cached and invalidated independently. A tile is
+ * only rasterized once it is requested, which the Widget does for the visible part of the document and a margin around it. Rendering happens on a
+ * private thread pool and tileReady() is emitted when a tile can be used. As soon as the tiles take up more memory than the budget, the least
+ * recently used tiles that are not on screen are evicted.
+ *
+ * When the zoom changes, the tiles of the previous zoom are kept as a preview. Until the tiles at the new zoom are ready, the preview is drawn
+ * scaled by the zoom ratio instead of the placeholder, and renders that were queued for the previous zoom are skipped.
+ *
+ * At zooms of mipmapZoom and below, whole pages are cached in a pyramid of images at power-of-two zooms instead, and the level closest above the
+ * current zoom is drawn scaled. Only the finest level that is needed is rendered from the strokes, coarser levels are downsampled from finer ones.
+ *
+ * All rects passed to and from the cache are in logical pixels relative to the top left corner of the page.
+ */
+class PageCache : public QObject
+{
+  Q_OBJECT
+public:
+  static constexpr int tileSize = 256;
+  static constexpr qreal mipmapZoom = 0.5;
+  static constexpr int numMipmapLevels = 6; // level k holds the page at zoom 2^-k
+
+  explicit PageCache(QObject *parent = 0);
+  ~PageCache();
+
+  void setBudget(qint64 budget);
+  qint64 budget() const;
+  qint64 usedMemory() const;
+
+  void setZoom(qreal zoom, int devicePixelRatio);
+  void setProgressiveZoom(bool progressiveZoom);
+  bool progressiveZoom() const;
+
+  int size() const;
+  void resize(int numPages);
+  void insertPage(int pageNum);
+  void removePage(int pageNum);
+  void invalidatePage(int pageNum);
+  void clear();
+
+  void beginFrame();
+  void request(int pageNum, const MrDoc::Page &page, const QRectF &rect);
+  void render(int pageNum, const MrDoc::Page &page, const QRectF &rect);
+  void paint(QPainter &painter, int pageNum, const MrDoc::Page &page, const QRectF &rect);
+
+  void updateRegion(int pageNum, const MrDoc::Page &page, const QRectF &rect);
+  void paintStroke(int pageNum, const MrDoc::Stroke &stroke, bool last = false);
+
+  static QImage renderTile(const MrDoc::Page &page, int column, int row, qreal zoom, int devicePixelRatio);
+  static QImage renderMipmap(const MrDoc::Page &page, int level, int devicePixelRatio);
+
+signals:
+  void tileReady(int pageNum, QRectF rect);
+
+private slots:
+  void imageReady(int pageNum, int key, int request, QImage image);
+  void mipmapReady(int pageNum, int level, int request, QImage image);
+
+private:
+  struct Tile
+  {
+    QPixmap pixmap;
+    quint64 lastUsed = 0;
+    int request = 0; // id of the pending render, 0 if there is none
+  };
+
+  struct Mipmap
+  {
+    QVector<QImage> levels; // null if the level isn't rendered
+    quint64 lastUsed = 0;
+    int request = 0;
+  };
+
+  static int tileKey(int column, int row);
+  static int tileColumn(int key);
+  static int tileRow(int key);
+
+  static QRectF tileRect(int key, int devicePixelRatio);
+  QRectF tileRect(int key) const;
+  static bool tileRange(const MrDoc::Page &page, const QRectF &rect, qreal zoom, int devicePixelRatio, int &firstColumn, int &lastColumn,
+                        int &firstRow, int &lastRow);
+  bool tileRange(const MrDoc::Page &page, const QRectF &rect, int &firstColumn, int &lastColumn, int &firstRow, int &lastRow) const;
+
+  void paintPreview(QPainter &painter, int pageNum, const MrDoc::Page &page, const QRectF &rect);
+
+  bool useMipmaps() const;
+  int mipmapLevel() const;
+  QRectF pageRect(const MrDoc::Page &page) const;
+  void requestMipmap(int pageNum, const MrDoc::Page &page, bool synchronous);
+  bool downsampleMipmap(int pageNum, const MrDoc::Page &page, int level);
+  bool paintMipmap(QPainter &painter, int pageNum, const QRectF &pageRect, const QRectF &rect);
+  int finestMipmapLevel(int pageNum) const;
+  void storeMipmap(int pageNum, int level, const QImage &image);
+  void clearMipmap(int pageNum, int keepLevel = -1);
+  qreal coverage(const QVector<QHash<int, Tile>> &pages, qreal zoom, int devicePixelRatio) const;
+
+  int nextRequest();
+  void storeTile(int pageNum, int key, const QPixmap &pixmap);
+  void dropPending(int pageNum);
+  void evict();
+  static qint64 pixmapSize(const QPixmap &pixmap);
+  static qint64 imageSize(const QImage &image);
+
+  QVector<QHash<int, Tile>> m_pages;
+  QVector<QHash<int, Tile>> m_previewPages;
+  QVector<Mipmap> m_mipmaps;
+  QThreadPool m_threadPool;
+
+  qreal m_zoom = 1.0;
+  int m_devicePixelRatio = 1;
+  qreal m_previewZoom = 1.0;
+  int m_previewDevicePixelRatio = 1;
+  bool m_progressiveZoom = true;
+  QAtomicInt m_generation; // incremented on every zoom change, renders of older generations are skipped
+
+  qint64 m_budget;
+  qint64 m_usedMemory = 0;
+  quint64 m_clock = 0;
+  int m_lastRequest = 0;
+};
+
+#endif // PAGECACHE_H
@@ -0,0 +1,62 @@
+#include "pageloader.h"
+#include "document.h"
+
+#include <QDebug>
+
+#include <limits>
+
+namespace MrDoc
+{
+
+MappedFile::MappedFile(const QString &fileName) : m_file(fileName)
+{
+  if (m_file.open(QIODevice::ReadOnly) && m_file.size() > 0 && m_file.size() <= std::numeric_limits<int>::max())
+  {
+    m_size = m_file.size();
+    m_data = reinterpret_cast<const char *>(m_file.map(0, m_size));
+  }
+}
+
+bool MappedFile::isMapped() const
+{
+  return m_data != nullptr;
+}
+
+/**
+ * @brief MappedFile::data
+ * @return the contents of the file, without copying them
+ */
+QByteArray MappedFile::data() const
+{
+  return QByteArray::fromRawData(m_data, m_size);
+}
+
+PageLoader::PageLoader(const QSharedPointer<MappedFile> &file, int offset, int size, const QSharedPointer<const QVector<int>> &styles)
+    : m_file(file), m_offset(offset), m_size(size), m_styles(styles)
+{
+}
+
+/**
+ * @brief PageLoader::page decodes the page on the first call.
+ * @return the decoded page
+ */
+Page PageLoader::page()
+{
+  QMutexLocker locker(&m_mutex);
+  if (m_file)
+  {
+    QByteArray chunk = QByteArray::fromRawData(m_file->data().constData() + m_offset, m_size);
+    if (!Document::loadBinaryMOJPage(chunk, m_page, *m_styles))
+    {
+      qWarning() << "damaged page in binary MOJ";
+      Page emptyPage;
+      emptyPage.setWidth(m_page.width());
+      emptyPage.setHeight(m_page.height());
+      emptyPage.setBackgroundColor(m_page.backgroundColor());
+      m_page = emptyPage;
+    }
+    m_file.reset();
+  }
+  return m_page;
+}
+}
@@ -0,0 +1,58 @@
+#ifndef PAGELOADER_H
+#define PAGELOADER_H
+
+#include "page.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+
+namespace MrDoc
+{
+
+/**
+ * @brief The MappedFile class maps a whole file into memory read-only. The mapping stays valid as long as the object exists.
+ */
+class MappedFile
+{
+public:
+  explicit MappedFile(const QString &fileName);
+
+  bool isMapped() const;
+  QByteArray data() const;
+
+private:
+  Q_DISABLE_COPY(MappedFile)
+
+  QFile m_file;
+  const char *m_data = nullptr;
+  qint64 m_size = 0;
+};
+
+/**
+ * @brief The PageLoader class decodes the strokes of a page of a binary MOJ the first time they are needed.
+ * @details Document::loadMOJ only reads the page table and the size and background of every page from a mapped binary MOJ, and gives each page a
+ * loader for its chunk. Copies of a page share the loader, so the chunk is decoded once, no matter which copy needs it first and on which thread.
+ * The mapped file is released once all pages that refer to it are decoded, which Document::loadAllPages() does before the file is replaced.
+ * Since decoding happens long after opening the file, a damaged chunk can't fail the load anymore; it yields a page without strokes.
+ */
+class PageLoader
+{
+public:
+  PageLoader(const QSharedPointer<MappedFile> &file, int offset, int size, const QSharedPointer<const QVector<int>> &styles);
+
+  Page page();
+
+private:
+  Q_DISABLE_COPY(PageLoader)
+
+  QMutex m_mutex;
+  QSharedPointer<MappedFile> m_file; // released once the page is decoded
+  int m_offset;
+  int m_size;
+  QSharedPointer<const QVector<int>> m_styles;
+  Page m_page;
+};
+}
+
+#endif // PAGELOADER_H
@@ -7,7 +7,7 @@
  * @param level The compression level to be used (@c 0 = no compression, @c 9 = max, @c -1 = default)
  * @return @c true if the compression was successful, @c false otherwise
  */
-bool QCompressor::gzipCompress(QByteArray input, QByteArray &output, int level)
+bool QCompressor::gzipCompress(const QByteArray &input, QByteArray &output, int level)
 {
   // Prepare output
   output.clear();
@@ -36,7 +36,7 @@ bool QCompressor::gzipCompress(QByteArray input, QByteArray &output, int level)
     output.clear();
 
     // Extract pointer to input data
-    char *input_data = input.data();
+    const char *input_data = input.constData();
     int input_data_left = input.length();
 
     // Compress data until available
@@ -107,7 +107,7 @@ bool QCompressor::gzipCompress(QByteArray input, QByteArray &output, int level)
  * @param output The result of the decompression
  * @return @c true if the decompression was successfull, @c false otherwise
  */
-bool QCompressor::gzipDecompress(QByteArray input, QByteArray &output)
+bool QCompressor::gzipDecompress(const QByteArray &input, QByteArray &output)
 {
   // Prepare output
   output.clear();
@@ -130,7 +130,7 @@ bool QCompressor::gzipDecompress(QByteArray input, QByteArray &output)
       return (false);
 
     // Extract pointer to input data
-    char *input_data = input.data();
+    const char *input_data = input.constData();
     int input_data_left = input.length();
 
     // Decompress data until available
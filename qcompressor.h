@@ -18,8 +18,8 @@
 class QCompressor
 {
 public:
-  static bool gzipCompress(QByteArray input, QByteArray &output, int level = -1);
-  static bool gzipDecompress(QByteArray input, QByteArray &output);
+  static bool gzipCompress(const QByteArray &input, QByteArray &output, int level = -1);
+  static bool gzipDecompress(const QByteArray &input, QByteArray &output);
 };
 
 #endif // QCOMPRESSOR_H
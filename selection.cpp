@@ -24,6 +24,48 @@ int Selection::pageNum() const
   return m_pageNum;
 }
 
+/**
+ * @brief Selection::setSource remembers the strokes a selection was made of and the page they were taken from. The journal records the change
+ * only when the selection is released, so until then it has the strokes in their old place.
+ * @param pageNum
+ * @param strokesAndIds
+ */
+void Selection::setSource(int pageNum, const QVector<QPair<Stroke, StrokeId>> &strokesAndIds)
+{
+  m_sourcePageNum = pageNum;
+  m_sourceStrokes = strokesAndIds;
+}
+
+/**
+ * @brief Selection::clearSource forgets where the strokes came from, for copies like the clipboard that are pasted as new strokes.
+ */
+void Selection::clearSource()
+{
+  m_sourcePageNum = -1;
+  m_sourceStrokes.clear();
+}
+
+int Selection::sourcePageNum() const
+{
+  return m_sourcePageNum;
+}
+
+const QVector<QPair<Stroke, StrokeId>> &Selection::sourceStrokes() const
+{
+  return m_sourceStrokes;
+}
+
+QVector<StrokeId> Selection::sourceIds() const
+{
+  QVector<StrokeId> ids;
+  ids.reserve(m_sourceStrokes.size());
+  for (const auto &sAndId : m_sourceStrokes)
+  {
+    ids.append(sAndId.second);
+  }
+  return ids;
+}
+
 void Selection::setSelectionPolygon(QPolygonF selectionPolygon)
 {
   m_selectionPolygon = selectionPolygon;
@@ -167,7 +209,7 @@ void Selection::updateBuffer(qreal zoom)
   Page::paint(imgPainter, upscale * zoom);
 }
 
-void Selection::paint(QPainter &painter, qreal zoom, QRectF region __attribute__((unused)))
+void Selection::paint(QPainter &painter, qreal zoom, QRectF region __attribute__((unused))) const
 {
   QTransform scaleTrans;
   scaleTrans = scaleTrans.scale(zoom, zoom);
@@ -243,16 +285,18 @@ void Selection::transform(QTransform transform, int pageNum)
 
   for (int i = 0; i < m_strokes.size(); ++i)
   {
-    m_strokes[i].points = transform.map(m_strokes[i].points);
+    m_strokes[i].transform(transform);
     /*
     'if (!transform.isRotating())' doesn't work, since rotation of 180 and 360 degrees is treated as a scaling transformation. Same goes for
     'if (transform.isScaling())'
     */
     if (transform.determinant() != 1)
     {
-      m_strokes[i].penWidth = m_strokes[i].penWidth * s;
+      m_strokes[i].setPenWidth(m_strokes[i].penWidth() * s);
     }
   }
+  updateStrokeGrid();
+
   if (transform.determinant() != 1)
   {
     m_x_padding *= sx;
@@ -30,6 +30,12 @@ public:
   void setPageNum(int pageNum);
   int pageNum() const;
 
+  void setSource(int pageNum, const QVector<QPair<Stroke, StrokeId>> &strokesAndIds);
+  void clearSource();
+  int sourcePageNum() const;
+  const QVector<QPair<Stroke, StrokeId>> &sourceStrokes() const;
+  QVector<StrokeId> sourceIds() const;
+
   void setSelectionPolygon(QPolygonF selectionPolygon);
   QPolygonF selectionPolygon() const;
 
@@ -43,7 +49,7 @@ public:
 
   QRectF boundingRect() const;
 
-  virtual void paint(QPainter &painter, qreal zoom, QRectF region = QRect(0, 0, 0, 0)) override;
+  virtual void paint(QPainter &painter, qreal zoom, QRectF region = QRect(0, 0, 0, 0)) const override;
 
   void transform(QTransform transform, int pageNum);
 
@@ -68,6 +74,9 @@ private:
 
   int m_pageNum;
 
+  int m_sourcePageNum = -1;
+  QVector<QPair<Stroke, StrokeId>> m_sourceStrokes; // the selected strokes as they were on the page, where the journal still has them
+
   qreal constexpr static m_rotateRectRadius = 8.0;
   qreal constexpr static m_rotateRectCenter = 20;
 };
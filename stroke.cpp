@@ -1,82 +1,909 @@
 #include "stroke.h"
 
+#include <QPair>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
 namespace MrDoc
 {
 
+OutlineCache::OutlineCache(const OutlineCache &other) : m_data(acquire(other.m_data.loadAcquire()))
+{
+}
+
+OutlineCache &OutlineCache::operator=(const OutlineCache &other)
+{
+  Data *data = acquire(other.m_data.loadAcquire());
+  release(m_data.fetchAndStoreOrdered(data));
+  return *this;
+}
+
+OutlineCache::~OutlineCache()
+{
+  release(m_data.loadAcquire());
+}
+
+/**
+ * @brief OutlineCache::get
+ * @param path gets the outline, if it was built
+ * @return false if the outline wasn't built yet
+ */
+bool OutlineCache::get(QPainterPath &path) const
+{
+  Data *data = m_data.loadAcquire();
+  if (!data)
+  {
+    return false;
+  }
+  path = data->path;
+  return true;
+}
+
+/**
+ * @brief OutlineCache::set stores an outline that was built, unless another thread was faster.
+ * @param path
+ */
+void OutlineCache::set(const QPainterPath &path) const
+{
+  Data *data = new Data(path);
+  if (!m_data.testAndSetOrdered(nullptr, data))
+  {
+    delete data;
+  }
+}
+
+/**
+ * @brief OutlineCache::clear drops the outline of this copy of the stroke, once its points change.
+ */
+void OutlineCache::clear()
+{
+  release(m_data.fetchAndStoreOrdered(nullptr));
+}
+
+OutlineCache::Data *OutlineCache::acquire(Data *data)
+{
+  if (data)
+  {
+    data->ref.ref();
+  }
+  return data;
+}
+
+void OutlineCache::release(Data *data)
+{
+  if (data && !data->ref.deref())
+  {
+    delete data;
+  }
+}
+
+constexpr qreal Stroke::widthQuantum;
+
 Stroke::Stroke()
 {
+  updateBoundingRect();
+}
+
+/**
+ * @brief Stroke::paint draws the stroke, as a filled outline if possible.
+ * @param painter
+ * @param zoom
+ * @param last only draw the last segment
+ */
+void Stroke::paint(QPainter &painter, qreal zoom, bool last) const
+{
+  paint(painter, zoom, StyleTable::instance().style(m_style), last);
 }
 
-void Stroke::paint(QPainter &painter, qreal zoom, bool last)
+/**
+ * @brief Stroke::paint draws the stroke with its style looked up already, which is how a page paints all of its strokes with a single look-up
+ * in the StyleTable.
+ * @param painter
+ * @param zoom
+ * @param style the style of the stroke
+ * @param last only draw the last segment
+ */
+void Stroke::paint(QPainter &painter, qreal zoom, const StyleTable::Style &style, bool last) const
 {
-  if (points.length() == 1)
+  if (m_size == 1)
   {
-    QRectF pointRect(zoom * points[0], QSizeF(0, 0));
-    qreal pad = penWidth * zoom / 2;
+    QRectF pointRect(zoom * point(0), QSizeF(0, 0));
+    qreal pad = m_penWidth * zoom / 2;
     painter.setPen(Qt::NoPen);
-    painter.setBrush(QBrush(color));
+    painter.setBrush(QBrush(style.color));
     painter.drawEllipse(pointRect.adjusted(-pad, -pad, pad, pad));
   }
-  else
+  else if (m_finished && !last && style.solid)
+  {
+    QTransform transform = painter.transform();
+    painter.scale(zoom, zoom);
+    painter.fillPath(cachedOutline(), style.color);
+    painter.setTransform(transform);
+  }
+  else if (m_size > 1)
+  {
+    paintSegments(painter, zoom, style, last);
+  }
+}
+
+/**
+ * @brief Stroke::paintSegments draws the stroke with a pen. Consecutive segments whose widths are equal after rounding to widthQuantum are drawn as
+ * one polyline, so a stroke with a constant pressure takes a single draw call.
+ * @param painter
+ * @param zoom
+ * @param style the style of the stroke
+ * @param last only draw the last segment
+ */
+void Stroke::paintSegments(QPainter &painter, qreal zoom, const StyleTable::Style &style, bool last) const
+{
+  bool dashed = !style.solid;
+  QPen pen;
+  pen.setColor(style.color);
+  if (dashed)
   {
-    QPen pen;
-    pen.setColor(color);
-    if (pattern != solidLinePattern)
+    pen.setDashPattern(style.pattern);
+  }
+  pen.setCapStyle(Qt::RoundCap);
+  pen.setJoinStyle(Qt::RoundJoin);
+
+  int n = m_size;
+  if (last)
+  {
+    if (dashed)
     {
-      pen.setDashPattern(pattern);
+      pen.setDashOffset(dashOffset());
     }
-    pen.setCapStyle(Qt::RoundCap);
+    pen.setWidthF(segmentWidth(n - 1, zoom));
     painter.setPen(pen);
-    qreal dashOffset = 0.0;
-    for (int j = 1; j < points.length(); ++j)
+    painter.drawLine(zoom * point(n - 2), zoom * point(n - 1));
+    return;
+  }
+
+  QPolygonF zoomedPoints(n);
+  const float *x = xData();
+  const float *y = yData();
+  for (int j = 0; j < n; ++j)
+  {
+    zoomedPoints[j] = QPointF(zoom * x[j], zoom * y[j]);
+  }
+
+  qreal offset = 0.0;
+  int runStart = 0;
+  qreal runWidth = segmentWidth(1, zoom);
+  qreal runDashOffset = 0.0;
+  for (int j = 1; j < n; ++j)
+  {
+    qreal tmpPenWidth = segmentWidth(j, zoom);
+    if (tmpPenWidth != runWidth)
     {
-      qreal tmpPenWidth = zoom * penWidth * (pressures.at(j - 1) + pressures.at(j)) / 2.0;
-      if (pattern != solidLinePattern)
+      // the run ends at point j - 1, which is also where the next one starts
+      if (dashed)
       {
-        pen.setDashOffset(dashOffset);
+        pen.setDashOffset(runDashOffset);
       }
-      pen.setWidthF(tmpPenWidth);
+      pen.setWidthF(runWidth);
       painter.setPen(pen);
-      //                painter.drawLine(zoom * points.at(j-1), zoom * points.at(j));
-      if (last == false)
+      painter.drawPolyline(zoomedPoints.constData() + runStart, j - runStart);
+
+      runStart = j - 1;
+      runWidth = tmpPenWidth;
+      runDashOffset = offset;
+    }
+    if (dashed)
+    {
+      offset += segmentDashLength(j);
+    }
+  }
+  if (dashed)
+  {
+    pen.setDashOffset(runDashOffset);
+  }
+  pen.setWidthF(runWidth);
+  painter.setPen(pen);
+  painter.drawPolyline(zoomedPoints.constData() + runStart, n - runStart);
+}
+
+/**
+ * @brief Stroke::segmentWidth
+ * @return the pen width of the segment from point j - 1 to point j at zoom, rounded to widthQuantum
+ */
+qreal Stroke::segmentWidth(int j, qreal zoom) const
+{
+  const float *pressures = pressureData();
+  qreal width = zoom * m_penWidth * (pressures[j - 1] + pressures[j]) / 2.0;
+  if (width <= 0.0)
+  {
+    return 0.0;
+  }
+  return qMax(widthQuantum, qRound(width / widthQuantum) * widthQuantum);
+}
+
+int Stroke::size() const
+{
+  return m_size;
+}
+
+bool Stroke::isEmpty() const
+{
+  return m_size == 0;
+}
+
+QPointF Stroke::point(int i) const
+{
+  Q_ASSERT(i >= 0 && i < m_size);
+  return QPointF(xData()[i], yData()[i]);
+}
+
+qreal Stroke::pressure(int i) const
+{
+  Q_ASSERT(i >= 0 && i < m_size);
+  return pressureData()[i];
+}
+
+const float *Stroke::xData() const
+{
+  return m_data;
+}
+
+const float *Stroke::yData() const
+{
+  return m_data + m_capacity;
+}
+
+const float *Stroke::pressureData() const
+{
+  return m_data + 2 * m_capacity;
+}
+
+/**
+ * @brief Stroke::points
+ * @return a copy of the points in double precision
+ */
+QPolygonF Stroke::points() const
+{
+  QPolygonF points(m_size);
+  for (int i = 0; i < m_size; ++i)
+  {
+    points[i] = point(i);
+  }
+  return points;
+}
+
+/**
+ * @brief Stroke::setPoints replaces all points of the stroke.
+ * @param points
+ * @param pressures has to be of the same length as points
+ */
+void Stroke::setPoints(const QPolygonF &points, const QVector<qreal> &pressures)
+{
+  Q_ASSERT(points.size() == pressures.size());
+  int n = points.size();
+  m_size = 0;
+  reallocate(n);
+  float *x = m_data;
+  float *y = m_data + n;
+  float *p = m_data + 2 * n;
+  for (int i = 0; i < n; ++i)
+  {
+    x[i] = points.at(i).x();
+    y[i] = points.at(i).y();
+    p[i] = pressures.at(i);
+  }
+  m_size = n;
+  updateGeometry();
+}
+
+/**
+ * @brief Stroke::setPoints replaces all points of the stroke.
+ * @param xs
+ * @param ys
+ * @param pressures
+ */
+void Stroke::setPoints(const QVector<float> &xs, const QVector<float> &ys, const QVector<float> &pressures)
+{
+  Q_ASSERT(xs.size() == ys.size() && xs.size() == pressures.size());
+  setPoints(xs.constData(), ys.constData(), pressures.constData(), xs.size());
+}
+
+/**
+ * @brief Stroke::setPoints replaces all points of the stroke with n points from the given arrays, which are copied with a single allocation.
+ * @param xs
+ * @param ys
+ * @param pressures
+ * @param n
+ * @param arena to allocate from, otherwise the stroke gets a block of its own
+ */
+void Stroke::setPoints(const float *xs, const float *ys, const float *pressures, int n, StrokeArena *arena)
+{
+  m_size = 0;
+  reallocate(n, arena);
+  std::copy(xs, xs + n, m_data);
+  std::copy(ys, ys + n, m_data + n);
+  std::copy(pressures, pressures + n, m_data + 2 * n);
+  m_size = n;
+  updateGeometry();
+}
+
+/**
+ * @brief Stroke::transform maps all points with transform. The pen width is left as it is.
+ * @param transform
+ */
+void Stroke::transform(const QTransform &transform)
+{
+  float *x = mutableData();
+  float *y = x + m_capacity;
+  for (int i = 0; i < m_size; ++i)
+  {
+    QPointF point = transform.map(QPointF(x[i], y[i]));
+    x[i] = point.x();
+    y[i] = point.y();
+  }
+  updateGeometry();
+}
+
+/**
+ * @brief Stroke::appendPoint adds a point to the end of the stroke. The cached geometry is extended instead of recomputed, and the arrays grow
+ * geometrically in a block of their own, so this is cheap while drawing.
+ * @param point
+ * @param pressure
+ */
+void Stroke::appendPoint(const QPointF &point, qreal pressure)
+{
+  if (m_size == m_capacity)
+  {
+    reallocate(qMax(16, 2 * m_capacity));
+  }
+  else
+  {
+    mutableData();
+  }
+  int n = m_size;
+  float *x = m_data;
+  float *y = m_data + m_capacity;
+  float *p = m_data + 2 * m_capacity;
+  x[n] = point.x();
+  y[n] = point.y();
+  p[n] = pressure;
+  ++m_size;
+  m_outline.clear();
+
+  // the cached geometry is computed from the stored, rounded point
+  QPointF storedPoint(x[n], y[n]);
+  if (n == 0)
+  {
+    m_pointsRect = QRectF(storedPoint, QSizeF(0.0, 0.0));
+  }
+  else
+  {
+    qreal left = qMin(m_pointsRect.left(), storedPoint.x());
+    qreal top = qMin(m_pointsRect.top(), storedPoint.y());
+    qreal right = qMax(m_pointsRect.right(), storedPoint.x());
+    qreal bottom = qMax(m_pointsRect.bottom(), storedPoint.y());
+    m_pointsRect = QRectF(QPointF(left, top), QPointF(right, bottom));
+  }
+  m_maxPressure = qMax(m_maxPressure, qreal(p[n]));
+  updateBoundingRect();
+  if (m_dashOffset < 0.0)
+  {
+    m_dashOffset = dashOffset();
+  }
+  else if (n >= 2)
+  {
+    // the last segment used to start at point n - 1
+    m_dashOffset += segmentDashLength(n - 1);
+  }
+  m_finished = false;
+}
+
+void Stroke::removePointAt(int i)
+{
+  Q_ASSERT(i >= 0 && i < m_size);
+  float *data = mutableData();
+  for (int k = 0; k < 3; ++k)
+  {
+    float *array = data + k * m_capacity;
+    std::copy(array + i + 1, array + m_size, array + i);
+  }
+  --m_size;
+  updateGeometry();
+}
+
+void Stroke::clearPoints()
+{
+  m_block.reset();
+  m_data = nullptr;
+  m_size = 0;
+  m_capacity = 0;
+  updateGeometry();
+}
+
+/**
+ * @brief Stroke::simplify removes points with the Ramer-Douglas-Peucker algorithm while the stroke stays within tolerance of the original. A point
+ * is only dropped if both its distance from the simplified line and the change of the half width at it, which follows the interpolated pressure,
+ * are below tolerance.
+ * @param tolerance in page coordinates
+ * @return true if points were removed
+ */
+bool Stroke::simplify(qreal tolerance)
+{
+  int n = m_size;
+  if (n < 3 || tolerance <= 0.0)
+  {
+    return false;
+  }
+
+  const float *x = xData();
+  const float *y = yData();
+  const float *p = pressureData();
+  QVector<char> keep(n, 0);
+  keep[0] = 1;
+  keep[n - 1] = 1;
+  int numKept = 2;
+
+  // ranges whose end points are kept, processed with an explicit stack since strokes can be long
+  QVector<QPair<int, int>> ranges;
+  ranges.append(qMakePair(0, n - 1));
+  while (!ranges.isEmpty())
+  {
+    int a = ranges.last().first;
+    int b = ranges.last().second;
+    ranges.removeLast();
+    if (b - a < 2)
+    {
+      continue;
+    }
+
+    qreal dx = x[b] - x[a];
+    qreal dy = y[b] - y[a];
+    qreal lengthSquared = dx * dx + dy * dy;
+    qreal maxError = 0.0;
+    int worst = -1;
+    for (int i = a + 1; i < b; ++i)
+    {
+      qreal t = 0.0;
+      if (lengthSquared > 0.0)
       {
-        painter.drawLine(zoom * points.at(j - 1), zoom * points.at(j));
+        t = qBound(0.0, ((x[i] - x[a]) * dx + (y[i] - y[a]) * dy) / lengthSquared, 1.0);
       }
-      else if (last == true && j == points.length() - 1)
+      qreal ex = x[a] + t * dx - x[i];
+      qreal ey = y[a] + t * dy - y[i];
+      qreal widthError = m_penWidth * qAbs(p[a] + t * (p[b] - p[a]) - p[i]) / 2.0;
+      qreal error = qMax(std::sqrt(ex * ex + ey * ey), widthError);
+      if (error > maxError)
       {
-        painter.drawLine(zoom * points.at(j - 1), zoom * points.at(j));
+        maxError = error;
+        worst = i;
       }
+    }
+    if (maxError > tolerance)
+    {
+      keep[worst] = 1;
+      ++numKept;
+      ranges.append(qMakePair(a, worst));
+      ranges.append(qMakePair(worst, b));
+    }
+  }
 
-      if (tmpPenWidth != 0)
-        dashOffset += 1.0 / tmpPenWidth * (QLineF(zoom * points.at(j - 1), zoom * points.at(j))).length();
+  if (numKept == n)
+  {
+    return false;
+  }
+  QVector<float> xs;
+  QVector<float> ys;
+  QVector<float> pressures;
+  xs.reserve(numKept);
+  ys.reserve(numKept);
+  pressures.reserve(numKept);
+  for (int i = 0; i < n; ++i)
+  {
+    if (keep.at(i))
+    {
+      xs.append(x[i]);
+      ys.append(y[i]);
+      pressures.append(p[i]);
     }
   }
+  setPoints(xs, ys, pressures);
+  return true;
+}
+
+QVector<qreal> Stroke::pattern() const
+{
+  return StyleTable::instance().pattern(m_style);
+}
+
+void Stroke::setPattern(const QVector<qreal> &pattern)
+{
+  m_style = StyleTable::instance().intern(color(), pattern);
+}
+
+qreal Stroke::penWidth() const
+{
+  return m_penWidth;
+}
+
+void Stroke::setPenWidth(qreal penWidth)
+{
+  m_penWidth = penWidth;
+  m_outline.clear();
+  m_dashOffset = -1.0;
+  updateBoundingRect();
+}
+
+QColor Stroke::color() const
+{
+  return StyleTable::instance().color(m_style);
+}
+
+void Stroke::setColor(const QColor &color)
+{
+  m_style = StyleTable::instance().intern(color, pattern());
+}
+
+/**
+ * @brief Stroke::style
+ * @return the index of color and pattern in the StyleTable
+ */
+int Stroke::style() const
+{
+  return m_style;
+}
+
+void Stroke::setStyle(int style)
+{
+  m_style = style;
 }
 
 QRectF Stroke::boundingRect() const
 {
-  QRectF bRect = boundingRectSansPenWidth();
-  qreal maxPressure = 0.0;
-  for (qreal p : pressures)
+  return m_boundingRect;
+}
+
+QRectF Stroke::boundingRectSansPenWidth() const
+{
+  return m_boundingRectSansPenWidth;
+}
+
+qreal Stroke::maxPressure() const
+{
+  return m_maxPressure;
+}
+
+/**
+ * @brief Stroke::segmentLength
+ * @return the length of the segment from point j - 1 to point j
+ */
+qreal Stroke::segmentLength(int j) const
+{
+  const float *x = xData();
+  const float *y = yData();
+  qreal dx = x[j] - x[j - 1];
+  qreal dy = y[j] - y[j - 1];
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * @brief Stroke::outline tessellates the stroke into a filled outline whose width follows the pressures. The stroke is split into pieces at sharp
+ * corners, each piece is a polygon of its left side, a round cap, its right side and another round cap. All pieces have the same orientation, so
+ * they can overlap with Qt::WindingFill.
+ * @param zoom
+ * @return the outline scaled by zoom, empty if the stroke has less than two points
+ */
+QPainterPath Stroke::outline(qreal zoom) const
+{
+  QPainterPath path;
+  path.setFillRule(Qt::WindingFill);
+  int n = m_size;
+  if (n < 2)
   {
-    if (p > maxPressure)
+    return path;
+  }
+  const float *pressures = pressureData();
+
+  // direction of every segment, segments of length zero take the direction of their neighbours
+  QVector<QPointF> directions(n - 1);
+  int firstDirection = -1;
+  for (int k = 0; k < n - 1; ++k)
+  {
+    qreal length = segmentLength(k + 1);
+    if (length > 0.0)
     {
-      maxPressure = p;
+      directions[k] = (point(k + 1) - point(k)) / length;
+      if (firstDirection == -1)
+      {
+        firstDirection = k;
+      }
+    }
+    else if (k > 0)
+    {
+      directions[k] = directions.at(k - 1);
     }
   }
-  qreal pad = maxPressure * penWidth;
-  return bRect.adjusted(-pad, -pad, pad, pad);
+  const int capSteps = 8;
+  if (firstDirection == -1)
+  {
+    qreal radius = m_penWidth * m_maxPressure / 2.0;
+    path.moveTo(zoom * (point(0) + QPointF(radius, 0.0)));
+    for (int step = 1; step < 2 * capSteps; ++step)
+    {
+      qreal t = M_PI * step / capSteps;
+      path.lineTo(zoom * (point(0) + radius * QPointF(qCos(t), qSin(t))));
+    }
+    path.closeSubpath();
+    return path;
+  }
+  for (int k = 0; k < firstDirection; ++k)
+  {
+    directions[k] = directions.at(firstDirection);
+  }
+
+  auto normal = [](const QPointF &direction)
+  {
+    return QPointF(direction.y(), -direction.x());
+  };
+  auto halfWidth = [this, pressures](int i)
+  {
+    return m_penWidth * pressures[i] / 2.0;
+  };
+  // offset of the left side at point j of the piece from first to last
+  auto sideOffset = [&directions, &normal, &halfWidth](int j, int first, int last)
+  {
+    QPointF offset;
+    if (j == first)
+    {
+      offset = normal(directions.at(j));
+    }
+    else if (j == last)
+    {
+      offset = normal(directions.at(j - 1));
+    }
+    else
+    {
+      // miter, which is at most sqrt(2) times the half width long since corners above 90 degrees are split
+      QPointF bisector = normal(directions.at(j - 1)) + normal(directions.at(j));
+      offset = bisector * (2.0 / QPointF::dotProduct(bisector, bisector));
+    }
+    return offset * halfWidth(j);
+  };
+
+  int pieceStart = 0;
+  for (int i = 1; i < n; ++i)
+  {
+    bool split = false;
+    if (i < n - 1)
+    {
+      // the offset of the inner side has to stay within the adjacent segments, otherwise it folds over
+      qreal cosAngle = QPointF::dotProduct(directions.at(i - 1), directions.at(i));
+      qreal sinAngle = qAbs(directions.at(i - 1).x() * directions.at(i).y() - directions.at(i - 1).y() * directions.at(i).x());
+      split = cosAngle < 0.0 || halfWidth(i) * sinAngle / (1.0 + cosAngle) > qMin(segmentLength(i), segmentLength(i + 1));
+    }
+    if (!split && i < n - 1)
+    {
+      continue;
+    }
+
+    path.moveTo(zoom * (point(pieceStart) + sideOffset(pieceStart, pieceStart, i)));
+    for (int j = pieceStart + 1; j <= i; ++j)
+    {
+      path.lineTo(zoom * (point(j) + sideOffset(j, pieceStart, i)));
+    }
+
+    QPointF endDirection = directions.at(i - 1);
+    QPointF endNormal = normal(endDirection);
+    for (int step = 1; step < capSteps; ++step)
+    {
+      qreal t = M_PI * step / capSteps;
+      path.lineTo(zoom * (point(i) + halfWidth(i) * (qCos(t) * endNormal + qSin(t) * endDirection)));
+    }
+
+    for (int j = i; j >= pieceStart; --j)
+    {
+      path.lineTo(zoom * (point(j) - sideOffset(j, pieceStart, i)));
+    }
+
+    QPointF startDirection = directions.at(pieceStart);
+    QPointF startNormal = normal(startDirection);
+    for (int step = 1; step < capSteps; ++step)
+    {
+      qreal t = M_PI * step / capSteps;
+      path.lineTo(zoom * (point(pieceStart) - halfWidth(pieceStart) * (qCos(t) * startNormal + qSin(t) * startDirection)));
+    }
+    path.closeSubpath();
+    pieceStart = i;
+  }
+  return path;
 }
 
-QRectF Stroke::boundingRectSansPenWidth() const
+/**
+ * @brief Stroke::segmentDashLength
+ * @return the length of the segment from point j - 1 to point j in units of its pen width, which is how far it moves the dash pattern
+ */
+qreal Stroke::segmentDashLength(int j) const
+{
+  const float *pressures = pressureData();
+  qreal width = m_penWidth * (pressures[j - 1] + pressures[j]) / 2.0;
+  return width > 0.0 ? segmentLength(j) / width : 0.0;
+}
+
+/**
+ * @brief Stroke::dashOffset
+ * @return the length of the stroke up to the start of its last segment in pen widths, which is where the dash pattern of that segment starts
+ */
+qreal Stroke::dashOffset() const
+{
+  if (m_dashOffset >= 0.0)
+  {
+    return m_dashOffset;
+  }
+  qreal offset = 0.0;
+  for (int j = 1; j < m_size - 1; ++j)
+  {
+    offset += segmentDashLength(j);
+  }
+  return offset;
+}
+
+/**
+ * @brief Stroke::cachedOutline
+ * @return the outline at zoom 1, which is built on the first call
+ */
+QPainterPath Stroke::cachedOutline() const
+{
+  QPainterPath path;
+  if (!m_outline.get(path))
+  {
+    path = outline();
+    m_outline.set(path);
+  }
+  return path;
+}
+
+/**
+ * @brief Stroke::isFinished
+ * @return false if points were appended since the stroke was finished, then it is drawn segment by segment
+ */
+bool Stroke::isFinished() const
+{
+  return m_finished;
+}
+
+/**
+ * @brief Stroke::finish marks a stroke that was drawn with appendPoint() as complete, so it is painted as a filled outline from now on.
+ */
+void Stroke::finish()
+{
+  m_finished = true;
+}
+
+/**
+ * @brief Stroke::updateGeometry recomputes everything that is derived from the points and pressures.
+ */
+void Stroke::updateGeometry()
+{
+  int n = m_size;
+  const float *x = xData();
+  const float *y = yData();
+  const float *p = pressureData();
+
+  float maxPressure = 0.0f;
+  for (int j = 0; j < n; ++j)
+  {
+    maxPressure = qMax(maxPressure, p[j]);
+  }
+  m_maxPressure = maxPressure;
+
+  if (n > 0)
+  {
+    float left = x[0];
+    float right = x[0];
+    float top = y[0];
+    float bottom = y[0];
+    for (int j = 1; j < n; ++j)
+    {
+      left = qMin(left, x[j]);
+      right = qMax(right, x[j]);
+      top = qMin(top, y[j]);
+      bottom = qMax(bottom, y[j]);
+    }
+    m_pointsRect = QRectF(QPointF(left, top), QPointF(right, bottom));
+  }
+  else
+  {
+    m_pointsRect = QRectF();
+  }
+
+  updateBoundingRect();
+  m_outline.clear();
+  m_dashOffset = -1.0;
+  m_finished = true;
+}
+
+void Stroke::updateBoundingRect()
 {
-  QPolygonF tmpPoints = points;
-  QRectF bRect = tmpPoints.boundingRect();
-  if (bRect.isNull())
+  m_boundingRectSansPenWidth = m_pointsRect;
+  if (m_boundingRectSansPenWidth.isNull())
   {
     qreal ad = 0.0001;
-    bRect.adjust(-ad,-ad,ad,ad);
+    m_boundingRectSansPenWidth.adjust(-ad, -ad, ad, ad);
+  }
+  qreal pad = m_maxPressure * m_penWidth;
+  m_boundingRect = m_boundingRectSansPenWidth.adjusted(-pad, -pad, pad, pad);
+}
+
+/**
+ * @brief Stroke::moveToArena copies the data of the stroke into arena, which frees the memory it used before unless a copy of the stroke still
+ * refers to it.
+ * @param arena
+ */
+void Stroke::moveToArena(StrokeArena &arena)
+{
+  if (m_size > 0)
+  {
+    reallocate(m_size, &arena);
+  }
+}
+
+/**
+ * @brief Stroke::block
+ * @return the block that holds the data of the stroke, nullptr if the stroke is empty
+ */
+const ArenaBlock *Stroke::block() const
+{
+  return m_block.data();
+}
+
+/**
+ * @brief Stroke::dataSize
+ * @return the number of floats that are allocated for the stroke
+ */
+int Stroke::dataSize() const
+{
+  return 3 * m_capacity;
+}
+
+/**
+ * @brief Stroke::reallocate moves the data of the stroke into a new allocation, which belongs to this stroke alone. Points beyond capacity are
+ * dropped.
+ * @param capacity number of points
+ * @param arena to allocate from, otherwise the stroke gets a block of its own
+ */
+void Stroke::reallocate(int capacity, StrokeArena *arena)
+{
+  QExplicitlySharedDataPointer<ArenaBlock> block;
+  float *data = nullptr;
+  int total = 3 * capacity;
+  if (total > 0)
+  {
+    data = arena ? arena->allocate(total, block) : StrokeArena::allocateBlock(total, block);
+  }
+
+  int n = qMin(m_size, capacity);
+  if (n > 0)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      std::copy(m_data + k * m_capacity, m_data + k * m_capacity + n, data + k * capacity);
+    }
+  }
+
+  m_block = block;
+  m_data = data;
+  m_size = n;
+  m_capacity = capacity;
+}
+
+/**
+ * @brief Stroke::mutableData copies the data of the stroke first if it is shared with another stroke.
+ * @return the arrays of the stroke, which can be written to
+ */
+float *Stroke::mutableData()
+{
+  if (m_block && m_block->ref.load() != 1)
+  {
+    reallocate(m_capacity);
   }
-  return bRect;
+  return m_data;
 }
 }
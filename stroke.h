@@ -1,35 +1,148 @@
 #ifndef STROKE_H
 #define STROKE_H
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QObject>
 #include <QPainter>
+#include <QPainterPath>
 #include <QVector>
 #include <QVector2D>
 
 #include "mrdoc.h"
+#include "strokearena.h"
+#include "styletable.h"
 
 namespace MrDoc
 {
 
 /**
- * @brief The Stroke struct
- * @todo turn this into a class. make sure, points and pressures are of the same length using a setter
+ * @brief The OutlineCache class holds the outline of a stroke once it is built. The outline is never changed afterwards, only dropped, so
+ * copies of the stroke share it and the render threads read it without a lock. The first outline that is stored wins if two threads build it at
+ * the same time.
  */
-struct Stroke
+class OutlineCache
 {
 public:
+  OutlineCache() = default;
+  OutlineCache(const OutlineCache &other);
+  OutlineCache &operator=(const OutlineCache &other);
+  ~OutlineCache();
+
+  bool get(QPainterPath &path) const;
+  void set(const QPainterPath &path) const;
+  void clear();
+
+private:
+  struct Data
+  {
+    explicit Data(const QPainterPath &path) : ref(1), path(path)
+    {
+    }
+
+    QAtomicInt ref;
+    QPainterPath path;
+  };
+
+  static Data *acquire(Data *data);
+  static void release(Data *data);
+
+  mutable QAtomicPointer<Data> m_data; // null until the outline is built
+};
+
+/**
+ * @brief The Stroke class holds the points of a stroke with their pressures and its style.
+ * @details The coordinates and pressures are stored as floats in three arrays of the same length, and the color and pattern are interned in
+ * the StyleTable. That is 12 bytes per point, half of a QPointF and a qreal pressure, and loops over the coordinates read contiguous memory. The
+ * arrays share one allocation, which is usually part of a block of the StrokeArena of the page (see moveToArena()). Copies of a stroke share that
+ * memory, it is copied when one of them is modified.
+ *
+ * The bounding rects and the maximum pressure are cached and kept up to date by the setters, so erasing and selecting don't have to recompute
+ * them. The dash offset of the last segment is kept up to date by appendPoint(), so drawing a dashed stroke costs the same for every point.
+ *
+ * Solid strokes are drawn as a filled outline that follows the pressure profile, which takes one fillPath() call. The outline is tessellated at
+ * zoom 1 the first time the stroke is painted and kept in an OutlineCache until the points or the pen width change, so loading doesn't pay for
+ * it, dashed strokes never do, and painting more tiles or zoom levels only scales it. A stroke that is being drawn with appendPoint() is drawn
+ * segment by segment until finish() is called.
+ */
+class Stroke
+{
+public:
+  static constexpr qreal widthQuantum = 0.25; // segments whose widths differ by less are drawn with the same pen
+
   Stroke();
   //    enum class dashPattern { SolidLine, DashLine, DashDotLine, DotLine };
-  void paint(QPainter &painter, qreal zoom, bool last = false);
+  void paint(QPainter &painter, qreal zoom, bool last = false) const;
+  void paint(QPainter &painter, qreal zoom, const StyleTable::Style &style, bool last = false) const;
+
+  int size() const;
+  bool isEmpty() const;
+  QPointF point(int i) const;
+  qreal pressure(int i) const;
+  const float *xData() const;
+  const float *yData() const;
+  const float *pressureData() const;
+  QPolygonF points() const;
+  void setPoints(const QPolygonF &points, const QVector<qreal> &pressures);
+  void setPoints(const QVector<float> &xs, const QVector<float> &ys, const QVector<float> &pressures);
+  void setPoints(const float *xs, const float *ys, const float *pressures, int n, StrokeArena *arena = nullptr);
+  void transform(const QTransform &transform);
+  void appendPoint(const QPointF &point, qreal pressure);
+  void removePointAt(int i);
+  void clearPoints();
+  bool simplify(qreal tolerance);
+
+  QVector<qreal> pattern() const;
+  void setPattern(const QVector<qreal> &pattern);
+
+  qreal penWidth() const;
+  void setPenWidth(qreal penWidth);
+
+  QColor color() const;
+  void setColor(const QColor &color);
+
+  int style() const;
+  void setStyle(int style);
 
   QRectF boundingRect() const;
   QRectF boundingRectSansPenWidth() const;
+  qreal maxPressure() const;
+
+  QPainterPath outline(qreal zoom = 1.0) const;
+  bool isFinished() const;
+  void finish();
+
+  void moveToArena(StrokeArena &arena);
+  const ArenaBlock *block() const;
+  int dataSize() const;
+
+private:
+  qreal segmentWidth(int j, qreal zoom) const;
+  qreal segmentLength(int j) const;
+  qreal segmentDashLength(int j) const;
+  qreal dashOffset() const;
+  QPainterPath cachedOutline() const;
+  void paintSegments(QPainter &painter, qreal zoom, const StyleTable::Style &style, bool last) const;
+  void updateGeometry();
+  void updateBoundingRect();
+  void reallocate(int capacity, StrokeArena *arena = nullptr);
+  float *mutableData();
+
+  QExplicitlySharedDataPointer<ArenaBlock> m_block; // keeps m_data alive
+  float *m_data = nullptr; // x, y and pressures with m_capacity floats each
+  int m_size = 0;
+  int m_capacity = 0;
+  qreal m_penWidth = 1.0;
+  int m_style = 0; // index into the StyleTable
 
-  QPolygonF points;
-  QVector<qreal> pressures;
-  QVector<qreal> pattern;
-  qreal penWidth;
-  QColor color;
+  // derived from the points and pressures
+  QRectF m_pointsRect; // like points().boundingRect()
+  QRectF m_boundingRectSansPenWidth;
+  QRectF m_boundingRect;
+  qreal m_maxPressure = 0.0;
+  qreal m_dashOffset = 0.0; // see dashOffset(), -1 if it has to be recomputed
+  bool m_finished = false; // drawn as an outline, false while points are appended
+  OutlineCache m_outline;
 };
 }
 
@@ -0,0 +1,116 @@
+#include "strokearena.h"
+
+#include <QtGlobal>
+
+namespace MrDoc
+{
+
+ArenaBlock::ArenaBlock(int capacity) : m_data(new float[capacity]), m_capacity(capacity)
+{
+}
+
+ArenaBlock::~ArenaBlock()
+{
+  delete[] m_data;
+}
+
+/**
+ * @brief ArenaBlock::allocate
+ * @param size in floats
+ * @return the allocated floats, or nullptr if the block is full
+ */
+float *ArenaBlock::allocate(int size)
+{
+  if (size > m_capacity - m_used)
+  {
+    return nullptr;
+  }
+  float *data = m_data + m_used;
+  m_used += size;
+  return data;
+}
+
+int ArenaBlock::capacity() const
+{
+  return m_capacity;
+}
+
+int ArenaBlock::used() const
+{
+  return m_used;
+}
+
+constexpr int StrokeArena::minBlockSize;
+constexpr int StrokeArena::blockSize;
+
+StrokeArena::StrokeArena()
+{
+}
+
+StrokeArena::StrokeArena(const StrokeArena &)
+{
+}
+
+StrokeArena &StrokeArena::operator=(const StrokeArena &)
+{
+  m_block.reset();
+  return *this;
+}
+
+/**
+ * @brief StrokeArena::allocate takes size floats from the current block, or starts a new block of twice the size if it is full. Sizes above a
+ * quarter of blockSize that don't fit get a block of their own, so a single long stroke doesn't leave most of a block empty.
+ * @param size
+ * @param block is set to the block that holds the returned memory
+ * @return
+ */
+float *StrokeArena::allocate(int size, QExplicitlySharedDataPointer<ArenaBlock> &block)
+{
+  float *data = m_block ? m_block->allocate(size) : nullptr;
+  if (!data)
+  {
+    if (size > blockSize / 4)
+    {
+      return allocateBlock(size, block);
+    }
+    int capacity = m_block ? qMax(minBlockSize, 2 * qMin(m_block->capacity(), blockSize / 2)) : minBlockSize;
+    m_block = new ArenaBlock(qMax(capacity, size));
+    data = m_block->allocate(size);
+  }
+  block = m_block;
+  return data;
+}
+
+/**
+ * @brief StrokeArena::reset makes the next allocation start a new block. Blocks that are still in use are kept alive by their strokes.
+ */
+void StrokeArena::reset()
+{
+  m_block.reset();
+}
+
+/**
+ * @brief StrokeArena::reserve starts a block of exactly size floats unless the current block has that much room left, so the next allocations of
+ * size floats in total don't start another block.
+ * @param size
+ */
+void StrokeArena::reserve(int size)
+{
+  if (size > 0 && (!m_block || m_block->capacity() - m_block->used() < size))
+  {
+    m_block = new ArenaBlock(size);
+  }
+}
+
+/**
+ * @brief StrokeArena::allocateBlock allocates a block that holds exactly size floats, for data that doesn't belong to an arena.
+ * @param size
+ * @param block is set to the new block
+ * @return
+ */
+float *StrokeArena::allocateBlock(int size, QExplicitlySharedDataPointer<ArenaBlock> &block)
+{
+  block = new ArenaBlock(size);
+  return block->allocate(size);
+}
+}
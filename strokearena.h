@@ -0,0 +1,62 @@
+#ifndef STROKEARENA_H
+#define STROKEARENA_H
+
+#include <QExplicitlySharedDataPointer>
+#include <QSharedData>
+
+namespace MrDoc
+{
+
+/**
+ * @brief The ArenaBlock class is a chunk of floats that is handed out front to back. Memory is only released when the whole block is destroyed,
+ * which happens when no stroke refers to it anymore.
+ */
+class ArenaBlock : public QSharedData
+{
+public:
+  explicit ArenaBlock(int capacity);
+  ~ArenaBlock();
+
+  float *allocate(int size);
+  int capacity() const;
+  int used() const;
+
+private:
+  Q_DISABLE_COPY(ArenaBlock)
+
+  float *m_data;
+  int m_capacity;
+  int m_used = 0;
+};
+
+/**
+ * @brief The StrokeArena class allocates the point data of the strokes of a page from a few large blocks instead of one allocation per stroke.
+ * @details Data in a block is never changed once a stroke refers to it, so strokes and pages can be copied freely and read from any thread. A
+ * stroke that is modified copies its data into a block of its own first. Copies of an arena start with a new block, so two pages never allocate
+ * from the same one.
+ *
+ * Blocks start small and double in size up to blockSize, so a page with a few strokes doesn't hold a large block. Data whose size is known up
+ * front, like the strokes of a page that is loaded or compacted, is put into a single block of that size with reserve().
+ */
+class StrokeArena
+{
+public:
+  static constexpr int minBlockSize = 1 << 12; // floats, 16 KiB
+  static constexpr int blockSize = 1 << 18;    // floats, 1 MiB, the largest block that is filled by allocate()
+
+  StrokeArena();
+  StrokeArena(const StrokeArena &);
+  StrokeArena &operator=(const StrokeArena &);
+
+  float *allocate(int size, QExplicitlySharedDataPointer<ArenaBlock> &block);
+  void reset();
+  void reserve(int size);
+
+  static float *allocateBlock(int size, QExplicitlySharedDataPointer<ArenaBlock> &block);
+
+private:
+  QExplicitlySharedDataPointer<ArenaBlock> m_block; // the block that is currently filled
+};
+}
+
+#endif // STROKEARENA_H
@@ -0,0 +1,114 @@
+#include "strokegrid.h"
+
+#include <QtMath>
+
+#include <algorithm>
+
+namespace MrDoc
+{
+
+constexpr qreal StrokeGrid::cellSize;
+
+StrokeGrid::StrokeGrid()
+{
+  m_cells.resize(m_columns * m_rows);
+}
+
+/**
+ * @brief StrokeGrid::reset resizes the grid to an empty page of width x height.
+ * @param width
+ * @param height
+ */
+void StrokeGrid::reset(qreal width, qreal height)
+{
+  m_columns = qMax(1, qCeil(width / cellSize));
+  m_rows = qMax(1, qCeil(height / cellSize));
+  m_cells = QVector<QVector<StrokeId>>(m_columns * m_rows);
+}
+
+/**
+ * @brief StrokeGrid::add indexes a stroke that was added or restored.
+ * @param id
+ * @param rect
+ */
+void StrokeGrid::add(StrokeId id, const QRectF &rect)
+{
+  int firstColumn, lastColumn, firstRow, lastRow;
+  cellRange(rect, firstColumn, lastColumn, firstRow, lastRow);
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      QVector<StrokeId> &cell = m_cells[row * m_columns + column];
+      cell.insert(std::lower_bound(cell.begin(), cell.end(), id), id);
+    }
+  }
+}
+
+/**
+ * @brief StrokeGrid::drop removes a stroke from its cells.
+ * @param id
+ * @param rect has to be the rect the stroke was indexed with
+ */
+void StrokeGrid::drop(StrokeId id, const QRectF &rect)
+{
+  int firstColumn, lastColumn, firstRow, lastRow;
+  cellRange(rect, firstColumn, lastColumn, firstRow, lastRow);
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      QVector<StrokeId> &cell = m_cells[row * m_columns + column];
+      auto it = std::lower_bound(cell.begin(), cell.end(), id);
+      if (it != cell.end() && *it == id)
+      {
+        cell.erase(it);
+      }
+    }
+  }
+}
+
+/**
+ * @brief StrokeGrid::move updates the cells of a stroke whose bounding rect changed.
+ */
+void StrokeGrid::move(StrokeId id, const QRectF &oldRect, const QRectF &newRect)
+{
+  drop(id, oldRect);
+  add(id, newRect);
+}
+
+/**
+ * @brief StrokeGrid::query
+ * @param rect
+ * @return the sorted ids of all strokes that are in a cell touched by rect. Their bounding rects don't necessarily intersect rect.
+ */
+QVector<StrokeId> StrokeGrid::query(const QRectF &rect) const
+{
+  int firstColumn, lastColumn, firstRow, lastRow;
+  cellRange(rect, firstColumn, lastColumn, firstRow, lastRow);
+
+  QVector<StrokeId> ids;
+  for (int row = firstRow; row <= lastRow; ++row)
+  {
+    for (int column = firstColumn; column <= lastColumn; ++column)
+    {
+      ids += m_cells.at(row * m_columns + column);
+    }
+  }
+  if (firstColumn != lastColumn || firstRow != lastRow)
+  {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  }
+  return ids;
+}
+
+void StrokeGrid::cellRange(const QRectF &rect, int &firstColumn, int &lastColumn, int &firstRow, int &lastRow) const
+{
+  QRectF normalizedRect = rect.normalized();
+  firstColumn = qBound(0, qFloor(normalizedRect.left() / cellSize), m_columns - 1);
+  lastColumn = qBound(0, qFloor(normalizedRect.right() / cellSize), m_columns - 1);
+  firstRow = qBound(0, qFloor(normalizedRect.top() / cellSize), m_rows - 1);
+  lastRow = qBound(0, qFloor(normalizedRect.bottom() / cellSize), m_rows - 1);
+}
+}
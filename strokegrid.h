@@ -0,0 +1,42 @@
+#ifndef STROKEGRID_H
+#define STROKEGRID_H
+
+#include <QRectF>
+#include <QVector>
+
+namespace MrDoc
+{
+
+typedef quint32 StrokeId; // identifies a stroke on its page for as long as the page exists
+
+/**
+ * @brief The StrokeGrid class is a spatial index over the bounding rects of the strokes of a page.
+ * @details The page is divided into square cells of cellSize post script units, and every cell holds the sorted ids of the strokes whose
+ * bounding rect touches it. Strokes outside of the page are put into the cells at the border. Since ids don't change when strokes are inserted
+ * in front of others, adding or removing a stroke only touches the cells of that stroke.
+ */
+class StrokeGrid
+{
+public:
+  static constexpr qreal cellSize = 64.0;
+
+  StrokeGrid();
+
+  void reset(qreal width, qreal height);
+
+  void add(StrokeId id, const QRectF &rect);
+  void drop(StrokeId id, const QRectF &rect);
+  void move(StrokeId id, const QRectF &oldRect, const QRectF &newRect);
+
+  QVector<StrokeId> query(const QRectF &rect) const;
+
+private:
+  void cellRange(const QRectF &rect, int &firstColumn, int &lastColumn, int &firstRow, int &lastRow) const;
+
+  int m_columns = 1;
+  int m_rows = 1;
+  QVector<QVector<StrokeId>> m_cells;
+};
+}
+
+#endif // STROKEGRID_H
@@ -0,0 +1,91 @@
+#include "styletable.h"
+#include "mrdoc.h"
+
+namespace MrDoc
+{
+
+StyleTable::StyleTable()
+{
+  m_styles.append({black, solidLinePattern, true});
+}
+
+StyleTable &StyleTable::instance()
+{
+  static StyleTable table;
+  return table;
+}
+
+/**
+ * @brief StyleTable::intern looks up a style and adds it if it isn't in the table yet.
+ * @param color
+ * @param pattern
+ * @return the index of the style
+ */
+int StyleTable::intern(const QColor &color, const QVector<qreal> &pattern)
+{
+  {
+    QReadLocker locker(&m_lock);
+    int style = find(color, pattern);
+    if (style != -1)
+    {
+      return style;
+    }
+  }
+
+  QWriteLocker locker(&m_lock);
+  // another thread might have added it in the meantime
+  int style = find(color, pattern);
+  if (style == -1)
+  {
+    style = m_styles.size();
+    m_styles.append({color, pattern, pattern == solidLinePattern});
+  }
+  return style;
+}
+
+StyleTable::Style StyleTable::style(int style) const
+{
+  QReadLocker locker(&m_lock);
+  return m_styles.at(style);
+}
+
+/**
+ * @brief StyleTable::styles
+ * @return all styles, indexed like the table; styles that are added later aren't in it
+ */
+QVector<StyleTable::Style> StyleTable::styles() const
+{
+  QReadLocker locker(&m_lock);
+  return m_styles;
+}
+
+QColor StyleTable::color(int style) const
+{
+  QReadLocker locker(&m_lock);
+  return m_styles.at(style).color;
+}
+
+QVector<qreal> StyleTable::pattern(int style) const
+{
+  QReadLocker locker(&m_lock);
+  return m_styles.at(style).pattern;
+}
+
+bool StyleTable::isSolid(int style) const
+{
+  QReadLocker locker(&m_lock);
+  return m_styles.at(style).solid;
+}
+
+int StyleTable::find(const QColor &color, const QVector<qreal> &pattern) const
+{
+  for (int i = 0; i < m_styles.size(); ++i)
+  {
+    if (m_styles.at(i).color == color && m_styles.at(i).pattern == pattern)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+}
@@ -0,0 +1,46 @@
+#ifndef STYLETABLE_H
+#define STYLETABLE_H
+
+#include <QColor>
+#include <QReadWriteLock>
+#include <QVector>
+
+namespace MrDoc
+{
+
+/**
+ * @brief The StyleTable class interns the color and dash pattern of strokes, so that a stroke only stores the index of its style.
+ * @details There is a single table that is shared by all documents. Styles are never removed, since a document only uses a handful of them. The
+ * table can be used from several threads, because strokes are painted on the render threads of the page cache. Painting a page takes a copy of
+ * all styles with styles() once, which is implicitly shared and read without the lock. Style 0 is black and solid, which is the style of a new
+ * stroke.
+ */
+class StyleTable
+{
+public:
+  struct Style
+  {
+    QColor color;
+    QVector<qreal> pattern;
+    bool solid; // pattern == solidLinePattern
+  };
+
+  static StyleTable &instance();
+
+  int intern(const QColor &color, const QVector<qreal> &pattern);
+  Style style(int style) const;
+  QVector<Style> styles() const;
+  QColor color(int style) const;
+  QVector<qreal> pattern(int style) const;
+  bool isSolid(int style) const;
+
+private:
+  StyleTable();
+  int find(const QColor &color, const QVector<qreal> &pattern) const;
+
+  mutable QReadWriteLock m_lock;
+  QVector<Style> m_styles;
+};
+}
+
+#endif // STYLETABLE_H
@@ -17,6 +17,8 @@
 #include <QTimer>
 #include <qmath.h>
 
+#include <algorithm>
+
 #define PAGE_GAP 10.0
 #define ZOOM_STEP 1.2
 
@@ -65,6 +67,12 @@ Widget::Widget(QWidget *parent) : QWidget(parent)
 
   currentCOSPos.setX(0.0);
   currentCOSPos.setY(0.0);
+
+  pageCache.setBudget(settings.value("PageCache/budget", 512).toLongLong() * 1024 * 1024);
+  pageCache.setProgressiveZoom(settings.value("PageCache/progressiveZoom", true).toBool());
+  simplifyTolerance = settings.value("Stroke/simplifyTolerance", simplifyTolerance).toDouble();
+  connect(&pageCache, SIGNAL(tileReady(int, QRectF)), this, SLOT(pageBufferReady(int, QRectF)));
+
   updateAllPageBuffers();
   setGeometry(getWidgetGeometry());
 
@@ -77,94 +85,74 @@ Widget::Widget(QWidget *parent) : QWidget(parent)
   updateDirtyTimer = new QTimer(this);
   connect(updateDirtyTimer, SIGNAL(timeout()), this, SLOT(updateAllDirtyBuffers()));
   updateDirtyTimer->setInterval(15);
-}
-
-void Widget::updateAllPageBuffers()
-{
-  QVector<QFuture<void>> future;
-  pageImageBuffer.clear();
-  for (int buffNum = 0; buffNum < currentDocument.pages.size(); ++buffNum)
-  {
-    pageImageBuffer.append(QImage());
-  }
 
-  for (int buffNum = 0; buffNum < currentDocument.pages.size(); ++buffNum)
-  {
-    future.append(QtConcurrent::run(this, &Widget::updateImageBuffer, buffNum));
-  }
-  pageBuffer.clear();
-  for (int buffNum = 0; buffNum < currentDocument.pages.size(); ++buffNum)
-  {
-    future[buffNum].waitForFinished();
-    pageBuffer.append(QPixmap::fromImage(pageImageBuffer.at(buffNum)));
+  // the point data of the pages is compacted once editing pauses
+  compactTimer = new QTimer(this);
+  compactTimer->setSingleShot(true);
+  compactTimer->setInterval(2000);
+  connect(compactTimer, SIGNAL(timeout()), this, SLOT(compactPages()));
+  connect(&undoStack, SIGNAL(indexChanged(int)), compactTimer, SLOT(start()));
 
-    // safe some memory
-    pageImageBufferMutex.lock();
-    pageImageBuffer[buffNum] = QImage();
-    pageImageBufferMutex.unlock();
-  }
-  pageImageBuffer.clear();
+  // every step of the undo stack is written to the journal at once
+  connect(&undoStack, SIGNAL(indexChanged(int)), this, SLOT(writeJournal()));
 }
 
-void Widget::updateImageBuffer(int buffNum)
+void Widget::updateAllPageBuffers()
 {
-  MrDoc::Page const &page = currentDocument.pages.at(buffNum);
-  int pixelWidth = zoom * page.width() * devicePixelRatio();
-  int pixelHeight = zoom * page.height() * devicePixelRatio();
-  QImage image(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
-  image.setDevicePixelRatio(devicePixelRatio());
-
-  image.fill(page.backgroundColor());
-
-  QPainter painter;
-  painter.begin(&image);
-  painter.setRenderHint(QPainter::Antialiasing, true);
-
-  currentDocument.pages[buffNum].paint(painter, zoom);
-
-  painter.end();
-
-  pageImageBufferMutex.lock();
-  pageImageBuffer.replace(buffNum, image);
-  pageImageBufferMutex.unlock();
+  pageCache.clear();
+  pageCache.setZoom(zoom, devicePixelRatio());
+  pageCache.resize(currentDocument.pages.size());
+  updatePageOffsets();
+  update();
 }
 
+/**
+ * @brief Widget::updateBuffer drops the buffer of a page, e.g. after its size changed. It is rendered again once it becomes visible.
+ * @param buffNum
+ */
 void Widget::updateBuffer(int buffNum)
 {
-  MrDoc::Page const &page = currentDocument.pages.at(buffNum);
-  int pixelWidth = zoom * page.width() * devicePixelRatio();
-  int pixelHeight = zoom * page.height() * devicePixelRatio();
-  QPixmap pixmap(pixelWidth, pixelHeight);
-  pixmap.setDevicePixelRatio(devicePixelRatio());
-
-  pixmap.fill(page.backgroundColor());
-
-  QPainter painter;
-  painter.begin(&pixmap);
-  painter.setRenderHint(QPainter::Antialiasing, true);
+  pageCache.invalidatePage(buffNum);
+  updatePageOffsets();
+  update();
+}
 
-  currentDocument.pages[buffNum].paint(painter, zoom);
+/**
+ * @brief Widget::ensurePageBuffer renders the visible part of a page right away, if it isn't there yet. Used before drawing directly onto the
+ * buffer.
+ * @param pageNum
+ */
+void Widget::ensurePageBuffer(int pageNum)
+{
+  QRectF visibleRect = visibleRegion().boundingRect();
+  pageCache.render(pageNum, currentDocument.pages.at(pageNum), visibleRect.translated(0.0, -pageOffsets.at(pageNum)));
+}
 
-  painter.end();
+/**
+ * @brief Widget::requestPageBuffers asks the page cache for all tiles that intersect rect.
+ * @param rect in widget coordinates
+ */
+void Widget::requestPageBuffers(const QRectF &rect)
+{
+  int numPages = qMin(pageCache.size(), pageOffsets.size() - 1);
+  int firstPage = getPageFromMousePos(rect.topLeft());
+  for (int i = firstPage; i < numPages && pageOffsets.at(i) <= rect.bottom(); ++i)
+  {
+    pageCache.request(i, currentDocument.pages.at(i), rect.translated(0.0, -pageOffsets.at(i)));
+  }
+}
 
-  pageBuffer.replace(buffNum, pixmap);
+void Widget::pageBufferReady(int pageNum, QRectF rect)
+{
+  if (pageNum < pageOffsets.size())
+  {
+    update(rect.translated(0.0, pageOffsets.at(pageNum)).toAlignedRect());
+  }
 }
 
 void Widget::updateBufferRegion(int buffNum, QRectF const &clipRect)
 {
-  QPainter painter;
-  painter.begin(&pageBuffer[buffNum]);
-  painter.setRenderHint(QPainter::Antialiasing, true);
-  painter.setClipRect(clipRect);
-  painter.setClipping(true);
-
-  painter.fillRect(clipRect, currentDocument.pages.at(buffNum).backgroundColor());
-  //    painter.fillRect(clipRect, Qt::red);
-
-  QRectF paintRect = QRectF(clipRect.topLeft() / zoom, clipRect.bottomRight() / zoom);
-  currentDocument.pages[buffNum].paint(painter, zoom, paintRect);
-
-  painter.end();
+  pageCache.updateRegion(buffNum, currentDocument.pages.at(buffNum), clipRect);
 }
 
 void Widget::updateAllDirtyBuffers()
@@ -182,26 +170,64 @@ void Widget::updateAllDirtyBuffers()
   update();
 }
 
+/**
+ * @brief Widget::compactPages moves the point data of every page into fresh arena blocks if its current blocks are mostly garbage.
+ */
+void Widget::compactPages()
+{
+  if (currentState != state::IDLE && currentState != state::SELECTED)
+  {
+    compactTimer->start();
+    return;
+  }
+  for (MrDoc::Page &page : currentDocument.pages)
+  {
+    page.compact();
+  }
+}
+
+/**
+ * @brief Widget::writeJournal writes the changes of the last step of the undo stack to the journal.
+ */
+void Widget::writeJournal()
+{
+  journal.flush();
+}
+
 void Widget::drawOnBuffer(bool last)
 {
-  QPainter painter;
-  painter.begin(&pageBuffer[drawingOnPage]);
-  painter.setRenderHint(QPainter::Antialiasing, true);
+  pageCache.paintStroke(drawingOnPage, currentStroke, last);
+}
 
-  currentStroke.paint(painter, zoom, last);
+/**
+ * @brief Widget::updatePageOffsets recomputes the prefix sum of page heights.
+ * @details The heights are the ones of the page buffers at the current zoom, so this has to be called whenever pages are added, removed or resized
+ * or the zoom changes. paintEvent() and the mouse position helpers use it to find pages in O(log n) instead of walking the whole document.
+ */
+void Widget::updatePageOffsets()
+{
+  pageOffsets.resize(currentDocument.pages.size() + 1);
+  qreal y = 0.0;
+  for (int i = 0; i < currentDocument.pages.size(); ++i)
+  {
+    pageOffsets[i] = y;
+    int pixelHeight = zoom * currentDocument.pages[i].height() * devicePixelRatio();
+    y += pixelHeight / static_cast<qreal>(devicePixelRatio()) + PAGE_GAP;
+  }
+  pageOffsets.last() = y;
 }
 
 QRect Widget::getWidgetGeometry()
 {
+  updatePageOffsets();
   int width = 0;
-  int height = 0;
-  for (int i = 0; i < pageBuffer.size(); ++i)
+  for (int i = 0; i < currentDocument.pages.size(); ++i)
   {
-    height += pageBuffer[i].height()/devicePixelRatio() + PAGE_GAP;
-    if (pageBuffer[i].width()/devicePixelRatio() > width)
-      width = pageBuffer[i].width()/devicePixelRatio();
+    int pixelWidth = zoom * currentDocument.pages[i].width() * devicePixelRatio();
+    if (pixelWidth / devicePixelRatio() > width)
+      width = pixelWidth / devicePixelRatio();
   }
-  height -= PAGE_GAP;
+  int height = pageOffsets.last() - PAGE_GAP;
   return QRect(0, 0, width, height);
 }
 
@@ -216,38 +242,36 @@ void Widget::paintEvent(QPaintEvent *event)
 
   if (currentState == state::DRAWING)
   {
-    QRectF rectSource;
-    QTransform trans;
-    for (int i = 0; i < drawingOnPage; ++i)
-    {
-      trans = trans.translate(0, -(pageBuffer.at(i).height() + PAGE_GAP*devicePixelRatio()));
-    }
-    trans = trans.scale(devicePixelRatio(),devicePixelRatio());
-    rectSource = trans.mapRect(event->rect());
-
-    //        QPixmap tmp = QPixmap::fromImage(pageBuffer.at(drawingOnPage));
-    painter.drawPixmap(event->rect(), pageBuffer[drawingOnPage], rectSource);
-
-    //        painter.drawImage(event->rect(), pageBuffer.at(drawingOnPage), rectSource);
+    painter.translate(QPointF(0.0, pageOffsets.at(drawingOnPage)));
+    QRectF rect = QRectF(event->rect()).translated(0.0, -pageOffsets.at(drawingOnPage));
+    pageCache.paint(painter, drawingOnPage, currentDocument.pages.at(drawingOnPage), rect);
     return;
   }
 
   //    painter.setRenderHint(QPainter::Antialiasing, true);
 
-  for (int i = 0; i < pageBuffer.size(); ++i)
+  int numPages = qMin(pageCache.size(), pageOffsets.size() - 1);
+  if (numPages == 0)
   {
-    QRectF rectSource;
-    rectSource.setTopLeft(QPointF(0.0, 0.0));
-    rectSource.setWidth(pageBuffer.at(i).width());
-    rectSource.setHeight(pageBuffer.at(i).height());
+    return;
+  }
+
+  // keep the visible tiles and a margin of half a screen around them rendered, everything else may be evicted
+  pageCache.beginFrame();
+  QRect visibleRect = visibleRegion().boundingRect();
+  requestPageBuffers(visibleRect);
+  requestPageBuffers(visibleRect.adjusted(0, -visibleRect.height() / 2, 0, visibleRect.height() / 2));
 
-    QRectF rectTarget;
-    //        rectTarget.setTopLeft(QPointF(0.0, currentYPos));
-    rectTarget.setTopLeft(QPointF(0.0, 0.0));
-    rectTarget.setWidth(pageBuffer.at(i).width()/devicePixelRatio());
-    rectTarget.setHeight(pageBuffer.at(i).height()/devicePixelRatio());
+  // only blit the pages that intersect the exposed rect
+  QRect exposedRect = event->rect();
+  int firstPage = std::upper_bound(pageOffsets.constBegin(), pageOffsets.constBegin() + numPages, exposedRect.top()) - pageOffsets.constBegin() - 1;
+  firstPage = qMax(firstPage, 0);
+
+  for (int i = firstPage; i < numPages && pageOffsets.at(i) <= exposedRect.bottom(); ++i)
+  {
+    painter.translate(QPointF(0.0, pageOffsets.at(i)));
 
-    painter.drawPixmap(rectTarget, pageBuffer.at(i), rectSource);
+    pageCache.paint(painter, i, currentDocument.pages.at(i), QRectF(exposedRect).translated(0.0, -pageOffsets.at(i)));
 
     if ((currentState == state::SELECTING || currentState == state::SELECTED || currentState == state::MOVING_SELECTION ||
          currentState == state::RESIZING_SELECTION || currentState == state::ROTATING_SELECTION) &&
@@ -256,7 +280,7 @@ void Widget::paintEvent(QPaintEvent *event)
       currentSelection.paint(painter, zoom);
     }
 
-    painter.translate(QPointF(0.0, rectSource.height()/devicePixelRatio() + PAGE_GAP));
+    painter.translate(QPointF(0.0, -pageOffsets.at(i)));
   }
 }
 
@@ -526,6 +550,7 @@ void Widget::mouseAndTabletEvent(QPointF mousePos, Qt::MouseButton button, Qt::M
         if (currentTool == tool::ERASER)
         {
           undoStack.beginMacro("erase");
+          previousEraserPos = mousePos;
           erase(mousePos, invertEraser);
           return;
         }
@@ -544,6 +569,7 @@ void Widget::mouseAndTabletEvent(QPointF mousePos, Qt::MouseButton button, Qt::M
         previousTool = currentTool;
         emit eraser();
         undoStack.beginMacro("erase");
+        previousEraserPos = mousePos;
         erase(mousePos, invertEraser);
       }
     }
@@ -756,13 +782,13 @@ void Widget::startRuling(QPointF mousePos)
 
   int pageNum = getPageFromMousePos(mousePos);
   QPointF pagePos = getPagePosFromMousePos(mousePos, pageNum);
+  ensurePageBuffer(pageNum);
 
   MrDoc::Stroke newStroke;
-  newStroke.pattern = currentPattern;
-  newStroke.points.append(pagePos);
-  newStroke.pressures.append(1);
-  newStroke.penWidth = currentPenWidth;
-  newStroke.color = currentColor;
+  newStroke.setPattern(currentPattern);
+  newStroke.appendPoint(pagePos, 1);
+  newStroke.setPenWidth(currentPenWidth);
+  newStroke.setColor(currentColor);
   currentStroke = newStroke;
   currentState = state::RULING;
 
@@ -776,21 +802,19 @@ void Widget::continueRuling(QPointF mousePos)
   QPointF pagePos = getPagePosFromMousePos(mousePos, drawingOnPage);
   QPointF previousPagePos = getPagePosFromMousePos(previousMousePos, drawingOnPage);
 
-  QPointF firstPagePos = currentStroke.points.at(0);
+  QPointF firstPagePos = currentStroke.point(0);
 
   QPointF oldPagePos = pagePos;
 
   currentDashOffset = 0.0;
 
-  if (currentStroke.points.length() > 1)
+  if (currentStroke.size() > 1)
   {
-    oldPagePos = currentStroke.points.at(1);
-    currentStroke.points.removeAt(1);
-    currentStroke.pressures.removeAt(1);
+    oldPagePos = currentStroke.point(1);
+    currentStroke.removePointAt(1);
   }
 
-  currentStroke.points.append(pagePos);
-  currentStroke.pressures.append(1);
+  currentStroke.appendPoint(pagePos, 1);
 
   QRect clipRect(zoom * firstPagePos.toPoint(), zoom * pagePos.toPoint());
   QRect oldClipRect(zoom * firstPagePos.toPoint(), zoom * previousPagePos.toPoint());
@@ -815,14 +839,12 @@ void Widget::stopRuling(QPointF mousePos)
 {
   QPointF pagePos = getPagePosFromMousePos(mousePos, drawingOnPage);
 
-  if (currentStroke.points.length() > 1)
+  if (currentStroke.size() > 1)
   {
-    currentStroke.points.removeAt(1);
-    currentStroke.pressures.removeAt(1);
+    currentStroke.removePointAt(1);
   }
 
-  currentStroke.points.append(pagePos);
-  currentStroke.pressures.append(1);
+  currentStroke.appendPoint(pagePos, 1);
 
   AddStrokeCommand *addCommand = new AddStrokeCommand(this, drawingOnPage, currentStroke);
   undoStack.push(addCommand);
@@ -838,13 +860,14 @@ void Widget::startCircling(QPointF mousePos)
   emit modified();
 
   int pageNum = getPageFromMousePos(mousePos);
+  ensurePageBuffer(pageNum);
 
   MrDoc::Stroke newStroke;
   //    newStroke.points.append(pagePos);
   //    newStroke.pressures.append(1);
-  newStroke.pattern = currentPattern;
-  newStroke.penWidth = currentPenWidth;
-  newStroke.color = currentColor;
+  newStroke.setPattern(currentPattern);
+  newStroke.setPenWidth(currentPenWidth);
+  newStroke.setColor(currentColor);
   currentStroke = newStroke;
   currentState = state::CIRCLING;
 
@@ -862,27 +885,25 @@ void Widget::continueCircling(QPointF mousePos)
 
   MrDoc::Stroke oldStroke = currentStroke;
 
-  currentStroke.points.clear();
-  currentStroke.pressures.clear();
-
   qreal radius = QLineF(firstPagePos, pagePos).length();
   qreal phi0 = QLineF(firstPagePos, pagePos).angle() * M_PI / 180.0;
 
   int N = 100;
+  QPolygonF points;
   for (int i = 0; i < N; ++i)
   {
     qreal phi = phi0 + i * (2.0 * M_PI / (N - 1));
     qreal x = firstPagePos.x() + radius * cos(phi);
     qreal y = firstPagePos.y() - radius * sin(phi);
-    currentStroke.points.append(QPointF(x, y));
-    currentStroke.pressures.append(1.0);
+    points.append(QPointF(x, y));
   }
+  currentStroke.setPoints(points, QVector<qreal>(N, 1.0));
 
   QTransform scaleTrans;
   scaleTrans = scaleTrans.scale(zoom, zoom);
 
-  QRect clipRect = scaleTrans.mapRect(currentStroke.points.boundingRect()).toRect();
-  QRect oldClipRect = scaleTrans.mapRect(oldStroke.points.boundingRect()).toRect();
+  QRect clipRect = scaleTrans.mapRect(currentStroke.boundingRectSansPenWidth()).toRect();
+  QRect oldClipRect = scaleTrans.mapRect(oldStroke.boundingRectSansPenWidth()).toRect();
   clipRect = clipRect.normalized().united(oldClipRect.normalized());
   int clipRad = zoom * currentPenWidth / 2 + 2;
   clipRect = clipRect.normalized().adjusted(-clipRad, -clipRad, clipRad, clipRad);
@@ -918,15 +939,15 @@ void Widget::startDrawing(QPointF mousePos, qreal pressure)
 
   int pageNum = getPageFromMousePos(mousePos);
   QPointF pagePos = getPagePosFromMousePos(mousePos, pageNum);
+  ensurePageBuffer(pageNum);
 
   currentDashOffset = 0.0;
 
   MrDoc::Stroke newStroke;
-  newStroke.pattern = currentPattern;
-  newStroke.points.append(pagePos);
-  newStroke.pressures.append(pressure);
-  newStroke.penWidth = currentPenWidth;
-  newStroke.color = currentColor;
+  newStroke.setPattern(currentPattern);
+  newStroke.appendPoint(pagePos, pressure);
+  newStroke.setPenWidth(currentPenWidth);
+  newStroke.setColor(currentColor);
   currentStroke = newStroke;
   //    drawing = true;
   currentState = state::DRAWING;
@@ -939,8 +960,7 @@ void Widget::continueDrawing(QPointF mousePos, qreal pressure)
 {
   QPointF pagePos = getPagePosFromMousePos(mousePos, drawingOnPage);
 
-  currentStroke.points.append(pagePos);
-  currentStroke.pressures.append(pressure);
+  currentStroke.appendPoint(pagePos, pressure);
   drawOnBuffer(true);
 
   QRect updateRect(previousMousePos.toPoint(), mousePos.toPoint());
@@ -958,11 +978,13 @@ void Widget::stopDrawing(QPointF mousePos, qreal pressure)
 
   QPointF pagePos = getPagePosFromMousePos(mousePos, drawingOnPage);
 
-  currentStroke.points.append(pagePos);
-  currentStroke.pressures.append(pressure);
+  currentStroke.appendPoint(pagePos, pressure);
   drawOnBuffer();
 
-  AddStrokeCommand *addCommand = new AddStrokeCommand(this, drawingOnPage, currentStroke, -1, false, true);
+  // drop the samples that make no visible difference at the resolution the stroke was drawn at
+  currentStroke.simplify(simplifyTolerance / (zoom * devicePixelRatio()));
+
+  AddStrokeCommand *addCommand = new AddStrokeCommand(this, drawingOnPage, currentStroke, false, true);
   undoStack.push(addCommand);
 
   //  currentState = state::IDLE;
@@ -975,154 +997,20 @@ void Widget::erase(QPointF mousePos, bool invertEraser)
 {
   int pageNum = getPageFromMousePos(mousePos);
   QPointF pagePos = getPagePosFromMousePos(mousePos, pageNum);
+  QPointF previousEraserPagePos = getPagePosFromMousePos(previousEraserPos, pageNum);
+  previousEraserPos = mousePos;
 
-  const QVector<MrDoc::Stroke> &strokes = currentDocument.pages[pageNum].strokes();
-
-  qreal eraserWidth = 10;
-
-  //    QLineF lineA = QLineF(pagePos + QPointF(-eraserWidth,-eraserWidth) / 2.0, pagePos + QPointF( eraserWidth,  eraserWidth) / 2.0);
-  //    QLineF lineB = QLineF(pagePos + QPointF( eraserWidth,-eraserWidth) / 2.0, pagePos + QPointF(-eraserWidth,  eraserWidth) / 2.0); // lineA and lineB
-  //    form a cross X
-
-  QLineF lineA = QLineF(pagePos + QPointF(-eraserWidth, -eraserWidth) / 2.0, pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0);
-  QLineF lineB = QLineF(pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, eraserWidth) / 2.0);
-  QLineF lineC = QLineF(pagePos + QPointF(eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0);
-  QLineF lineD = QLineF(pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0, pagePos + QPointF(-eraserWidth, -eraserWidth) / 2.0); // lineA B C D form a square
-
-  QRectF rectE = QRectF(pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0);
-
-  QVector<int> strokesToDelete;
-  QPointF iPoint;
-
-  QPointF iPointA;
-  QPointF iPointB;
-  QPointF iPointC;
-  QPointF iPointD;
-
-  bool intersected;
-
-  if (realEraser || (!realEraser && invertEraser))
-  {
-    for (int i = strokes.size() - 1; i >= 0; --i)
-    {
-      MrDoc::Stroke stroke = strokes.at(i);
-      if (rectE.intersects(stroke.points.boundingRect()) || !stroke.points.boundingRect().isValid()) // this is done for speed
-      {
-        for (int j = 0; j < stroke.points.length() - 1; ++j)
-        {
-          QLineF line = QLineF(stroke.points.at(j), stroke.points.at(j + 1));
-          if (line.intersect(lineA, &iPointA) == QLineF::BoundedIntersection && iPointA != stroke.points.first() && iPointA != stroke.points.last())
-          {
-            iPoint = iPointA;
-            intersected = true;
-          }
-          else if (line.intersect(lineB, &iPointB) == QLineF::BoundedIntersection && iPointB != stroke.points.first() && iPointB != stroke.points.last())
-          {
-            iPoint = iPointB;
-            intersected = true;
-          }
-          else if (line.intersect(lineC, &iPointC) == QLineF::BoundedIntersection && iPointC != stroke.points.first() && iPointC != stroke.points.last())
-          {
-            iPoint = iPointC;
-            intersected = true;
-          }
-          else if (line.intersect(lineD, &iPointD) == QLineF::BoundedIntersection && iPointD != stroke.points.first() && iPointD != stroke.points.last())
-          {
-            iPoint = iPointD;
-            intersected = true;
-          }
-          else
-          {
-            intersected = false;
-          }
-
-          if (intersected)
-          {
-            //                        if (iPoint != stroke.points.first() && iPoint != stroke.points.last())
-            {
-              MrDoc::Stroke splitStroke = stroke;
-              splitStroke.points = splitStroke.points.mid(0, j + 1);
-              splitStroke.points.append(iPoint);
-              splitStroke.pressures = splitStroke.pressures.mid(0, j + 1);
-              qreal lastPressure = splitStroke.pressures.last();
-              splitStroke.pressures.append(lastPressure);
-
-              stroke.points = stroke.points.mid(j + 1);
-              stroke.points.prepend(iPoint);
-              stroke.pressures = stroke.pressures.mid(j + 1);
-              qreal firstPressure = stroke.pressures.first();
-              stroke.pressures.prepend(firstPressure);
-
-              RemoveStrokeCommand *removeStrokeCommand = new RemoveStrokeCommand(this, pageNum, i, false);
-              undoStack.push(removeStrokeCommand);
-              AddStrokeCommand *addStrokeCommand = new AddStrokeCommand(this, pageNum, stroke, i, false, false);
-              undoStack.push(addStrokeCommand);
-              addStrokeCommand = new AddStrokeCommand(this, pageNum, splitStroke, i, false, false);
-              undoStack.push(addStrokeCommand);
-              //                            strokes.insert(i, splitStroke);
-              i += 2;
-              break;
-            }
-          }
-        }
-      }
-    }
-  }
-  //    return;
-
-  eraserWidth = eraserWidth * 0.99;
-  lineA = QLineF(pagePos + QPointF(-eraserWidth, -eraserWidth) / 2.0, pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0);
-
-  lineB = QLineF(pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, eraserWidth) / 2.0);
-  lineC = QLineF(pagePos + QPointF(eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0);
-  lineD = QLineF(pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0, pagePos + QPointF(-eraserWidth, -eraserWidth) / 2.0); // lineA B C D form a square
+  bool split = realEraser || invertEraser;
+  QVector<MrDoc::Eraser::Hit> hits = currentEraser.erase(currentDocument.pages[pageNum], previousEraserPagePos, pagePos, split);
 
-  rectE = QRectF(pagePos + QPointF(-eraserWidth, eraserWidth) / 2.0, pagePos + QPointF(eraserWidth, -eraserWidth) / 2.0);
-
-  for (int i = 0; i < strokes.size(); ++i)
-  {
-    const MrDoc::Stroke stroke = strokes.at(i);
-    if (rectE.intersects(stroke.points.boundingRect()) || !stroke.points.boundingRect().isValid()) // this is done for speed
-    {
-      bool foundStrokeToDelete = false;
-      for (int j = 0; j < stroke.points.length(); ++j)
-      {
-        if (rectE.contains(stroke.points.at(j)))
-        {
-          strokesToDelete.append(i);
-          foundStrokeToDelete = true;
-          break;
-        }
-      }
-      if (foundStrokeToDelete == false)
-      {
-        for (int j = 0; j < stroke.points.length() - 1; ++j)
-        {
-          QLineF line = QLineF(stroke.points.at(j), stroke.points.at(j + 1));
-          if (line.intersect(lineA, &iPoint) == QLineF::BoundedIntersection || line.intersect(lineB, &iPoint) == QLineF::BoundedIntersection ||
-              line.intersect(lineC, &iPoint) == QLineF::BoundedIntersection || line.intersect(lineD, &iPoint) == QLineF::BoundedIntersection)
-          {
-            strokesToDelete.append(i);
-            break;
-          }
-        }
-      }
-    }
-  }
-
-  if (strokesToDelete.size() > 0)
+  if (hits.size() > 0)
   {
     currentDocument.setDocumentChanged(true);
     emit modified();
 
-    //    QRect updateRect;
-    std::sort(strokesToDelete.begin(), strokesToDelete.end(), std::greater<int>());
-    for (int i = 0; i < strokesToDelete.size(); ++i)
-    {
-      //      updateRect = updateRect.united(currentDocument.pages[pageNum].m_strokes.at(strokesToDelete.at(i)).points.boundingRect().toRect());
-      RemoveStrokeCommand *removeCommand = new RemoveStrokeCommand(this, pageNum, strokesToDelete[i]);
-      undoStack.push(removeCommand);
-    }
+    // merged with the previous steps of the gesture
+    EraseCommand *eraseCommand = new EraseCommand(this, pageNum, hits);
+    undoStack.push(eraseCommand);
   }
   updateAllDirtyBuffers();
 }
@@ -1322,17 +1210,9 @@ void Widget::stopResizingSelection(QPointF mousePos)
 int Widget::getPageFromMousePos(QPointF mousePos)
 {
   qreal y = mousePos.y(); // - currentCOSPos.y();
-  int pageNum = 0;
-  while (y > (floor(currentDocument.pages[pageNum].height() * zoom)) + PAGE_GAP)
-  {
-    y -= (floor(currentDocument.pages[pageNum].height() * zoom)) + PAGE_GAP;
-    pageNum += 1;
-    if (pageNum >= currentDocument.pages.size())
-    {
-      pageNum = currentDocument.pages.size() - 1;
-      break;
-    }
-  }
+  int numPages = qMin(currentDocument.pages.size(), pageOffsets.size() - 1);
+  int pageNum = std::upper_bound(pageOffsets.constBegin(), pageOffsets.constBegin() + numPages, y) - pageOffsets.constBegin() - 1;
+  pageNum = qMax(pageNum, 0);
   return pageNum;
 }
 
@@ -1349,14 +1229,7 @@ int Widget::getCurrentPage()
 QPointF Widget::getPagePosFromMousePos(QPointF mousePos, int pageNum)
 {
   qreal x = mousePos.x();
-  qreal y = mousePos.y();
-  for (int i = 0; i < pageNum; ++i)
-  {
-    //        y -= (currentDocument.pages[i].height() * zoom + PAGE_GAP); // THIS DOESN'T WORK PROPERLY (should be floor(...height(), or just use
-    //        pageBuffer[i].height()/devicePixelRatio())
-    y -= (pageBuffer[i].height()/devicePixelRatio() + PAGE_GAP);
-  }
-  //    y -= (pageNum) * (currentDocument.pages[0].height() * zoom + PAGE_GAP);
+  qreal y = mousePos.y() - pageOffsets.at(pageNum);
 
   QPointF pagePos = (QPointF(x, y)) / zoom;
 
@@ -1368,12 +1241,7 @@ QPointF Widget::getAbsolutePagePosFromMousePos(QPointF mousePos)
   int pageNum = getPageFromMousePos(mousePos);
   QPointF pagePos = getPagePosFromMousePos(mousePos, pageNum);
 
-  qreal y = 0.0;
-  for (int i = 0; i < pageNum; ++i)
-  {
-    y += (pageBuffer[i].height()/devicePixelRatio() + PAGE_GAP);
-  }
-  y *= zoom;
+  qreal y = pageOffsets.at(pageNum) * zoom;
 
   pagePos.setY(y + pagePos.y());
 
@@ -1385,7 +1253,6 @@ void Widget::newFile()
   letGoSelection();
 
   currentDocument = MrDoc::Document();
-  pageBuffer.clear();
   undoStack.clear();
   updateAllPageBuffers();
   QRect widgetGeometry = getWidgetGeometry();
@@ -1438,7 +1305,8 @@ void Widget::zoomTo(qreal newZoom)
   int prevH = scrollArea->horizontalScrollBar()->value();
   int prevV = scrollArea->verticalScrollBar()->value();
 
-  updateAllPageBuffers();
+  // keeps the current tiles as a preview until the new ones are rendered
+  pageCache.setZoom(zoom, devicePixelRatio());
   currentSelection.updateBuffer(zoom);
   setGeometry(getWidgetGeometry());
 
@@ -1591,12 +1459,8 @@ void Widget::scrollDocumentToPageNum(int pageNum)
   {
     pageNum = 0;
   }
-  qreal y = 0.0;
   //    qreal x = currentCOSPos.x();
-  for (int i = 0; i < pageNum; ++i)
-  {
-    y += (currentDocument.pages[i].height()) * zoom + PAGE_GAP;
-  }
+  qreal y = pageOffsets.at(pageNum);
 
   scrollArea->verticalScrollBar()->setValue(y);
 
@@ -1633,7 +1497,7 @@ void Widget::setDocument(const MrDoc::Document &newDocument)
 {
   currentDocument = newDocument;
   undoStack.clear();
-  pageBuffer.clear();
+  updateAllPageBuffers();
   zoom = 0.0; // otherwise zoomTo() doesn't do anything if zoom == newZoom
   zoomFitWidth();
   pageFirst();
@@ -1651,7 +1515,10 @@ void Widget::selectAll()
   QRectF selectRect;
   for (auto &stroke : currentDocument.pages[pageNum].strokes())
   {
-    selectRect = selectRect.united(stroke.boundingRect());
+    if (!stroke.isEmpty())
+    {
+      selectRect = selectRect.united(stroke.boundingRect());
+    }
   }
   QPolygonF selectionPolygon = QPolygonF(selectRect);
 
@@ -1677,6 +1544,7 @@ void Widget::selectAll()
 void Widget::copy()
 {
   clipboard = currentSelection;
+  clipboard.clearSource();
   update();
 }
 
@@ -11,7 +11,6 @@
 #include <QTabletEvent>
 #include <QUndoStack>
 #include <QScrollArea>
-#include <QMutex>
 
 #include <QTime>
 #include <QTimer>
@@ -19,6 +18,9 @@
 #include "tabletapplication.h"
 #include "mrdoc.h"
 #include "document.h"
+#include "pagecache.h"
+#include "eraser.h"
+#include "journal.h"
 
 class Widget : public QWidget
 // class Widget : public QOpenGLWidget
@@ -73,14 +75,14 @@ public:
                            QTabletEvent::PointerType pointerType, QEvent::Type eventType, qreal pressure, bool tabletEvent);
 
   /**
-   * @brief updateAllPageBuffers
-   * @todo use std::unique_lock
+   * @brief updateAllPageBuffers drops all page buffers. They are rendered again on demand, when the pages become visible.
    */
   void updateAllPageBuffers();
-  void updateImageBuffer(int buffNum);
   void updateBuffer(int i);
+  void ensurePageBuffer(int pageNum);
   void updateBufferRegion(int buffNum, QRectF const &clipRect);
   void drawOnBuffer(bool last = false);
+  void updatePageOffsets();
   int getPageFromMousePos(QPointF mousePos);
   QPointF getPagePosFromMousePos(QPointF mousePos, int pageNum);
   QPointF getAbsolutePagePosFromMousePos(QPointF mousePos);
@@ -108,9 +110,12 @@ public:
   void rotateSelection(qreal angle);
 
   MrDoc::Document currentDocument;
-  QVector<QPixmap> pageBuffer;
-  QVector<QImage> pageImageBuffer;
-  QMutex pageImageBufferMutex;
+  PageCache pageCache;
+  /**
+   * @brief pageOffsets holds the y position of the top of every page in widget coordinates.
+   * The last entry is the position where the next page would start, so it always has one entry more than there are pages.
+   */
+  QVector<qreal> pageOffsets;
 
   QColor currentColor;
   qreal currentPenWidth;
@@ -128,6 +133,7 @@ public:
   QScrollArea *scrollArea;
 
   QUndoStack undoStack;
+  MrDoc::Journal journal; // the undo commands record their changes in it
 
   qreal zoom;
 
@@ -136,6 +142,7 @@ private:
 
   QTimer *updateTimer;
   QTimer *updateDirtyTimer;
+  QTimer *compactTimer;
 
   qreal count;
 
@@ -159,12 +166,16 @@ private:
   tool currentTool;
   tool previousTool;
   bool realEraser;
+  MrDoc::Eraser currentEraser;
+  QPointF previousEraserPos;
 
   qreal currentDashOffset;
 
   qreal minWidthMultiplier = 0.0;
   qreal maxWidthMultiplier = 1.25;
 
+  qreal simplifyTolerance = 0.25; // in device pixels at the zoom a stroke is drawn at, 0 keeps all points
+
   QPointF currentCOSPos;
   QPointF firstMousePos;
   QPointF previousMousePos;
@@ -200,10 +211,15 @@ private:
 
   void setPreviousTool();
 
+  void requestPageBuffers(const QRectF &rect);
+
   void erase(QPointF mousePos, bool invertEraser = false);
 
 private slots:
   void updateAllDirtyBuffers();
+  void pageBufferReady(int pageNum, QRectF rect);
+  void compactPages();
+  void writeJournal();
 
   void undo();
   void redo();